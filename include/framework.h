@@ -8,8 +8,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <iomanip>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -37,11 +49,49 @@ inline mat4 rotate(float angle, const vec3& v) {
 	return rotate(mat4(1.0f), angle, v);
 }
 
+// glUniform* for each type a uniform can have
+inline void uniform(int location, int i) {
+	glUniform1i(location, i);
+}
+inline void uniform(int location, float f) {
+	glUniform1f(location, f);
+}
+inline void uniform(int location, const vec2& v) {
+	glUniform2fv(location, 1, &v.x);
+}
+inline void uniform(int location, const vec3& v) {
+	glUniform3fv(location, 1, &v.x);
+}
+inline void uniform(int location, const vec4& v) {
+	glUniform4fv(location, 1, &v.x);
+}
+inline void uniform(int location, const mat4& mat) {
+	glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+}
+
+// The location of a uniform of type T, looked up once by GPUProgram::uniform(); setting it is a single
+// glUniform* call. The program has to be in use, as with setUniform.
+template <class T>
+class Uniform {
+	int location = -1;
+
+   public:
+	Uniform() {}
+	explicit Uniform(int location) : location(location) {}
+	void set(const T& value) const {
+		if (location >= 0) uniform(location, value);
+	}
+	bool valid() const {
+		return location >= 0;
+	}
+};
+
 //---------------------------
 class GPUProgram {
 	//--------------------------
 	GLuint shaderProgramId = 0;
 	bool waitError = true;
+	std::unordered_map<std::string, int> locations;	 // of the active uniforms, filled by link()
 
 	bool checkShader(unsigned int shader, std::string message) {  // shader ford�t�si hib�k kezel�se
 		GLint infoLogLength = 0, result = 0;
@@ -71,8 +121,25 @@ class GPUProgram {
 		return true;
 	}
 
+	void findLocations() {	// active uniforms, with the [0] of arrays dropped
+		locations.clear();
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(shaderProgramId, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(shaderProgramId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> name(maxLength + 1);
+		for (GLint i = 0; i < count; i++) {
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(shaderProgramId, i, (GLsizei)name.size(), NULL, &size, &type, name.data());
+			std::string n = name.data();
+			if (n.size() > 3 && n.compare(n.size() - 3, 3, "[0]") == 0) n.resize(n.size() - 3);
+			locations[n] = glGetUniformLocation(shaderProgramId, n.c_str());
+		}
+	}
+
 	int getLocation(const std::string& name) {	// uniform v�ltoz� c�m�nek lek�rdez�se
-		int location = glGetUniformLocation(shaderProgramId, name.c_str());
+		auto found = locations.find(name);
+		int location = found == locations.end() ? -1 : found->second;
 		if (location < 0) printf("uniform %s cannot be set\n", name.c_str());
 		return location;
 	}
@@ -222,41 +289,58 @@ class GPUProgram {
 
 	bool link() {
 		glLinkProgram(shaderProgramId);
-		return checkLinking(shaderProgramId);
+		if (!checkLinking(shaderProgramId)) return false;
+		findLocations();
+		return true;
 	}
 
 	void Use() {
 		glUseProgram(shaderProgramId);
 	}  // make this program run
 
+	// makes the uniform block name read the buffer bound to binding with glBindBufferBase
+	void bindBlock(const std::string& name, int binding) {
+		GLuint index = glGetUniformBlockIndex(shaderProgramId, name.c_str());
+		if (index == GL_INVALID_INDEX) {
+			printf("uniform block %s cannot be bound\n", name.c_str());
+			return;
+		}
+		glUniformBlockBinding(shaderProgramId, index, binding);
+	}
+
+	template <class T>
+	Uniform<T> uniform(const std::string& name) {
+		return Uniform<T>(getLocation(name));
+	}
+
 	void setUniform(int i, const std::string& name) {
 		int location = getLocation(name);
-		if (location >= 0) glUniform1i(location, i);
+		if (location >= 0) ::uniform(location, i);
 	}
 
 	void setUniform(float f, const std::string& name) {
 		int location = getLocation(name);
-		if (location >= 0) glUniform1f(location, f);
+		if (location >= 0) ::uniform(location, f);
 	}
 
 	void setUniform(const vec2& v, const std::string& name) {
 		int location = getLocation(name);
-		if (location >= 0) glUniform2fv(location, 1, &v.x);
+		if (location >= 0) ::uniform(location, v);
 	}
 
 	void setUniform(const vec3& v, const std::string& name) {
 		int location = getLocation(name);
-		if (location >= 0) glUniform3fv(location, 1, &v.x);
+		if (location >= 0) ::uniform(location, v);
 	}
 
 	void setUniform(const vec4& v, const std::string& name) {
 		int location = getLocation(name);
-		if (location >= 0) glUniform4fv(location, 1, &v.x);
+		if (location >= 0) ::uniform(location, v);
 	}
 
 	void setUniform(const mat4& mat, const std::string& name) {
 		int location = getLocation(name);
-		if (location >= 0) glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+		if (location >= 0) ::uniform(location, mat);
 	}
 
 	~GPUProgram() {
@@ -264,43 +348,166 @@ class GPUProgram {
 	}
 };
 
+//---------------------------
+class StreamBuffer {
+	//---------------------------
+	// Vertex data written once and drawn in the same frame goes to a ring of three regions of one buffer.
+	// With buffer storage (GL 4.4) the buffer is mapped persistently and a fence keeps a region from being
+	// rewritten while the GPU still reads it; without it the buffer is orphaned when the ring is full and
+	// written with glBufferSubData, so the driver never stalls on it either way.
+	static const int frames = 3;
+	unsigned int id = 0;
+	size_t region = 0;	// bytes per frame
+	size_t head = 0, end = 0;
+	int current = 0;
+	GLsync fences[frames] = {};
+	char* mapped = nullptr;
+	bool persistent = false;
+	unsigned long long frame = 0, generation = 0;
+
+	void allocate(size_t bytes) {
+		if (id > 0) glDeleteBuffers(1, &id);  // draws already issued keep the old store alive
+		for (auto& f : fences) {
+			if (f) glDeleteSync(f);
+			f = 0;
+		}
+		region = bytes;
+		glGenBuffers(1, &id);
+		glBindBuffer(GL_ARRAY_BUFFER, id);
+		if (persistent) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_ARRAY_BUFFER, frames * region, NULL, flags);
+			mapped = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, frames * region, flags);
+		} else {
+			glBufferData(GL_ARRAY_BUFFER, frames * region, NULL, GL_STREAM_DRAW);
+		}
+		current = 0;
+		head = 0;
+		end = persistent ? region : frames * region;
+		generation++;
+	}
+
+   public:
+	// where push() put the data; it can be drawn from while valid() holds
+	struct Allocation {
+		size_t offset = 0;
+		unsigned long long frame = 0, generation = 0;
+		unsigned long long revision = 0;  // of the data, see update()
+	};
+
+	StreamBuffer(size_t bytes = 1 << 22) {
+		persistent = GLAD_GL_VERSION_4_4 && glBufferStorage != NULL;
+		allocate(bytes);
+	}
+
+	unsigned int Id() {
+		return id;
+	}
+
+	// copies the data into the ring at a multiple of align, leaves the buffer bound to GL_ARRAY_BUFFER
+	Allocation push(const void* data, size_t bytes, size_t align = 16) {
+		size_t offset = (head + align - 1) / align * align;
+		if (offset + bytes > end) {
+			if (bytes > region || persistent) {
+				allocate(std::max(2 * region, bytes));	// the frame outgrew its region
+			} else {
+				glBindBuffer(GL_ARRAY_BUFFER, id);
+				glBufferData(GL_ARRAY_BUFFER, frames * region, NULL, GL_STREAM_DRAW);  // orphaning
+				generation++;
+			}
+			offset = persistent ? current * region : 0;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, id);
+		if (persistent) {
+			memcpy(mapped + offset, data, bytes);
+		} else {
+			glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+		}
+		head = offset + bytes;
+		Allocation a;
+		a.offset = offset;
+		a.frame = frame;
+		a.generation = generation;
+		return a;
+	}
+
+	// the region of a is rewritten only when the ring comes back to it, frames frames later
+	bool valid(const Allocation& a) {
+		return a.generation == generation && (!persistent || frame - a.frame < frames);
+	}
+
+	// for data drawn over several frames: pushes it again only when its revision moved since a was pushed
+	// or the ring moved past a, leaves the buffer bound to GL_ARRAY_BUFFER and returns the offset
+	size_t update(Allocation& a, const void* data, size_t bytes, unsigned long long revision) {
+		if (a.revision != revision || !valid(a)) {
+			a = push(data, bytes);
+			a.revision = revision;
+		} else {
+			glBindBuffer(GL_ARRAY_BUFFER, id);
+		}
+		return a.offset;
+	}
+
+	// after the draws of a frame: fences its region and moves to the next one, waiting for the GPU if it
+	// still reads that
+	void endFrame() {
+		frame++;
+		if (!persistent) return;
+		fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		current = (current + 1) % frames;
+		head = current * region;
+		end = head + region;
+		if (fences[current]) {
+			while (glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+			}
+			glDeleteSync(fences[current]);
+			fences[current] = 0;
+		}
+	}
+};
+
+// Created on first use, in the GL context, and never destroyed, so that no GL call runs after the
+// context is gone.
+inline StreamBuffer& streamBuffer() {
+	static StreamBuffer* buffer = new StreamBuffer();
+	return *buffer;
+}
+
 //---------------------------
 template <class T>
 class Geometry {
 	//---------------------------
-	unsigned int vao, vbo;	// GPU
+	unsigned int vao;						 // GPU
+	StreamBuffer::Allocation allocation;	 // of vtx in streamBuffer()
    protected:
 	std::vector<T> vtx;	 // CPU
    public:
 	Geometry() {
 		glGenVertexArrays(1, &vao);
 		glBindVertexArray(vao);
-		glGenBuffers(1, &vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
 		glEnableVertexAttribArray(0);
-		int nf = min((int)(sizeof(T) / sizeof(float)), 4);
-		glVertexAttribPointer(0, nf, GL_FLOAT, GL_FALSE, 0, NULL);
 	}
 	std::vector<T>& Vtx() {
 		return vtx;
 	}
 	void updateGPU() {	// CPU -> GPU
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, vtx.size() * sizeof(T), &vtx[0], GL_DYNAMIC_DRAW);
+		if (vtx.size() > 0) allocation = streamBuffer().push(&vtx[0], vtx.size() * sizeof(T));
 	}
 	void Bind() {
 		glBindVertexArray(vao);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		if (!streamBuffer().valid(allocation)) updateGPU();	 // the ring moved past the last upload
+		glBindBuffer(GL_ARRAY_BUFFER, streamBuffer().Id());
+		int nf = min((int)(sizeof(T) / sizeof(float)), 4);
+		glVertexAttribPointer(0, nf, GL_FLOAT, GL_FALSE, 0, (void*)allocation.offset);
 	}  // aktiv�l�s
 	void Draw(GPUProgram* prog, int type, vec3 color) {
 		if (vtx.size() > 0) {
 			prog->setUniform(color, "color");
-			glBindVertexArray(vao);
+			Bind();
 			glDrawArrays(type, 0, (int)vtx.size());
 		}
 	}
 	virtual ~Geometry() {
-		glDeleteBuffers(1, &vbo);
 		glDeleteVertexArrays(1, &vao);
 	}
 };
@@ -373,9 +580,585 @@ class Texture {
 	}
 };
 
+//---------------------------
+class ThreadPool {
+	//---------------------------
+	// every worker pops its own queue from the back and steals from the front of the others
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+	std::vector<std::unique_ptr<Queue>> queues;	 // one per worker, the last one is fed by other threads
+	std::vector<std::thread> workers;
+	std::atomic<int> queued{0};
+	std::atomic<bool> stop{false};
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	inline static thread_local int self = -1;  // queue of the current thread
+
+	void push(std::function<void()> task) {
+		Queue& q = *queues[self >= 0 ? self : queues.size() - 1];
+		{
+			std::lock_guard<std::mutex> lock(q.mutex);
+			q.tasks.push_back(std::move(task));
+		}
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			queued++;
+		}
+		wake.notify_one();
+	}
+
+	bool pop(size_t i, bool back, std::function<void()>& task) {
+		Queue& q = *queues[i];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.tasks.empty()) return false;
+		if (back) {
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+		} else {
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+		}
+		queued--;
+		return true;
+	}
+
+	// runs one task, own queue first; false if every queue is empty
+	bool run_one() {
+		std::function<void()> task;
+		size_t n = queues.size();
+		size_t home = self >= 0 ? self : n - 1;
+		bool found = pop(home, true, task);
+		for (size_t k = 1; !found && k < n; k++) {
+			found = pop((home + k) % n, false, task);
+		}
+		if (found) task();
+		return found;
+	}
+
+	void work(int i) {
+		self = i;
+		while (!stop) {
+			if (run_one()) continue;
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			wake.wait(lock, [this] { return stop || queued > 0; });
+		}
+	}
+
+   public:
+	// the thread calling parallel_for works too, hence one worker less than the cores
+	ThreadPool(unsigned int threads = std::thread::hardware_concurrency()) {
+		int n = threads > 1 ? (int)threads - 1 : 0;
+		for (int i = 0; i <= n; i++) queues.push_back(std::make_unique<Queue>());
+		for (int i = 0; i < n; i++) workers.emplace_back(&ThreadPool::work, this, i);
+	}
+
+	size_t size() {
+		return workers.size() + 1;
+	}
+
+	// calls f(begin, end) on the chunks of [0, n), at most grain long, and waits for all of them
+	template <class F>
+	void parallel_for(size_t n, size_t grain, F&& f) {
+		if (n == 0) return;
+		grain = grain > 0 ? grain : 1;
+		size_t chunks = (n + grain - 1) / grain;
+		if (chunks == 1 || workers.empty()) {
+			f((size_t)0, n);
+			return;
+		}
+		std::atomic<size_t> remaining(chunks);
+		for (size_t c = 0; c < chunks; c++) {
+			size_t begin = c * grain, end = std::min(n, begin + grain);
+			push([&f, &remaining, begin, end] {
+				f(begin, end);
+				remaining--;
+			});
+		}
+		while (remaining > 0) {
+			if (!run_one()) std::this_thread::yield();
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			stop = true;
+		}
+		wake.notify_all();
+		for (auto& w : workers) w.join();
+	}
+};
+
+inline ThreadPool& threadPool() {
+	static ThreadPool pool;
+	return pool;
+}
+
+//---------------------------
+template <class T>
+class TripleBuffer {
+	//---------------------------
+	// Hands the latest value from one writer thread to one reader thread without locks or waiting. The
+	// writer fills its slot and swaps it with the middle one; the reader swaps the middle one with its
+	// own when the writer has published since. A slot the writer gets back holds an older value, not
+	// the one it just published.
+	static const int fresh = 4;	 // in middle: published since the reader last took it
+	T slots[3];
+	std::atomic<int> middle{1};
+	int back = 0, front = 2;
+
+   public:
+	T& write() {  // writer only
+		return slots[back];
+	}
+
+	void publish() {  // writer only
+		back = middle.exchange(back | fresh, std::memory_order_acq_rel) & ~fresh;
+	}
+
+	// takes the latest published value; false if there is nothing newer than read()
+	bool update() {	 // reader only
+		if (!(middle.load(std::memory_order_relaxed) & fresh)) return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & ~fresh;
+		return true;
+	}
+
+	const T& read() const {	 // reader only
+		return slots[front];
+	}
+};
+
+//---------------------------
+class FrameCapture {
+	//---------------------------
+	// Frames are read back into a ring of pixel buffer objects and fenced, so glReadPixels returns at
+	// once. A frame is mapped when its fence has passed, or when more than latency frames are waiting, and
+	// encoder threads write the mapped memory to PNG files. The encoders are threads of their own, so
+	// that long encodes do not hold up parallel_for. The buffers come from a fixed pool: capture() waits
+	// for a free one, so when encoding falls behind the renderer slows down instead of the memory
+	// filling up. With buffer storage (GL 4.4) the buffers stay mapped; otherwise they are unmapped on
+	// the GL thread once encoded. Everything but the encoding runs on the GL thread.
+	struct Frame {
+		unsigned int pbo = 0;
+		size_t size = 0;  // bytes of the pbo
+		const unsigned char* pixels = nullptr;	// the mapped pbo, bottom-up as glReadPixels gives them
+		GLsync fence = 0;
+		int width = 0, height = 0;
+		std::string file;
+	};
+	static const size_t latency = 2;  // frames read back but not mapped
+	std::vector<std::unique_ptr<Frame>> frames;
+	std::vector<Frame*> idle;
+	std::deque<Frame*> reading;	 // in capture order
+	std::deque<Frame*> queue;	 // mapped, in capture order
+	std::vector<Frame*> done;	 // encoded, to be unmapped
+	std::vector<std::thread> encoders;
+	std::mutex mutex;  // of queue, done, stop and failures
+	std::condition_variable freed, queued;
+	bool persistent = false;
+	bool stop = false;
+	int failures = 0;
+
+	void encode() {
+		std::vector<unsigned char> image;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			queued.wait(lock, [this] { return stop || !queue.empty(); });
+			if (queue.empty()) return;
+			Frame* f = queue.front();
+			queue.pop_front();
+			lock.unlock();
+
+			// PNG rows go top-down and glReadPixels gives them bottom-up, so every frame is copied once more
+			// here, flipped. lodepng takes no row stride, and rendering upside down for the capture would
+			// reach into every draw; the copy costs the encoder thread far less than the compression.
+			size_t row = f->width * 4;
+			image.resize(row * f->height);
+			for (int y = 0; y < f->height; y++) {
+				memcpy(&image[y * row], &f->pixels[(f->height - 1 - y) * row], row);
+			}
+			unsigned error = lodepng_encode32_file(f->file.c_str(), image.data(), f->width, f->height);
+			if (error) fprintf(stderr, "Error: %s: %s\n", f->file.c_str(), lodepng_error_text(error));
+
+			lock.lock();
+			if (error) failures++;
+			done.push_back(f);
+			freed.notify_all();
+		}
+	}
+
+	// gives the frames the encoders are done with back to idle
+	void reclaim() {
+		std::vector<Frame*> encoded;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			encoded.swap(done);
+		}
+		for (Frame* f : encoded) {
+			if (!persistent) {
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, f->pbo);
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				f->pixels = nullptr;
+			}
+			idle.push_back(f);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	// maps the oldest frame read back and queues it to the encoders; false if wait is not set and the
+	// GPU has not written it yet. A frame that cannot be mapped is lost: it counts as a failure and its
+	// buffer goes back to idle.
+	bool map(bool wait) {
+		Frame* f = reading.front();
+		GLenum status = glClientWaitSync(f->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (wait && status == GL_TIMEOUT_EXPIRED) {
+			status = glClientWaitSync(f->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		}
+		if (status == GL_TIMEOUT_EXPIRED) return false;
+		glDeleteSync(f->fence);
+		f->fence = 0;
+		if (!persistent) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, f->pbo);
+			f->pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, f->size, GL_MAP_READ_BIT);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+		reading.pop_front();
+		if (f->pixels == nullptr) {
+			fprintf(stderr, "Error: %s: the pixel buffer cannot be mapped\n", f->file.c_str());
+			if (persistent) f->size = 0;	// allocated and mapped again when it is next used
+			idle.push_back(f);
+			std::lock_guard<std::mutex> lock(mutex);
+			failures++;
+			return true;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(f);
+		}
+		queued.notify_one();
+		return true;
+	}
+
+	void allocate(Frame* f, size_t size) {
+		if (f->pbo > 0) glDeleteBuffers(1, &f->pbo);
+		glGenBuffers(1, &f->pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, f->pbo);
+		if (persistent) {
+			GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_PACK_BUFFER, size, NULL, flags);
+			f->pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, flags);
+		} else {
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		}
+		f->size = size;
+	}
+
+   public:
+	// frames in flight: the ones being read back, the queued ones and the ones being encoded
+	FrameCapture(unsigned int threads = std::max(1u, std::thread::hardware_concurrency() / 2),
+				 unsigned int buffers = 0) {
+		if (buffers == 0) buffers = 2 * threads + latency + 1;
+		persistent = GLAD_GL_VERSION_4_4 && glBufferStorage != NULL;
+		for (unsigned int i = 0; i < buffers; i++) {
+			frames.push_back(std::make_unique<Frame>());
+			idle.push_back(frames.back().get());
+		}
+		for (unsigned int i = 0; i < threads; i++) encoders.emplace_back(&FrameCapture::encode, this);
+	}
+
+	// starts reading width x height pixels of the bound read framebuffer, to be written to file
+	void capture(const std::string& file, int width, int height) {
+		reclaim();
+		while (!reading.empty() && map(reading.size() > latency)) {
+		}
+		while (idle.empty()) {	// back-pressure
+			if (!reading.empty()) {
+				map(true);
+				continue;
+			}
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				freed.wait(lock, [this] { return !done.empty(); });
+			}
+			reclaim();
+		}
+		Frame* f = idle.back();
+		idle.pop_back();
+		size_t size = (size_t)width * height * 4;
+		if (f->size != size) {
+			allocate(f, size);
+		} else {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, f->pbo);
+		}
+		f->width = width;
+		f->height = height;
+		f->file = file;
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		f->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		reading.push_back(f);
+	}
+
+	// waits until every captured frame is written; false if one of them could not be since the last call
+	bool finish() {
+		while (!reading.empty()) map(true);
+		while (true) {
+			reclaim();
+			if (idle.size() == frames.size()) break;
+			std::unique_lock<std::mutex> lock(mutex);
+			freed.wait(lock, [this] { return !done.empty(); });
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		bool ok = failures == 0;
+		failures = 0;
+		return ok;
+	}
+
+	~FrameCapture() {
+		finish();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		queued.notify_all();
+		for (auto& e : encoders) e.join();
+		for (auto& f : frames) {
+			if (f->pbo > 0) glDeleteBuffers(1, &f->pbo);  // unmaps the persistent ones
+		}
+	}
+};
+
+//---------------------------
+class Profiler {
+	//---------------------------
+	// CPU scopes time a block on the thread that runs it, GPU scopes put a pair of GL_TIMESTAMP queries
+	// around the commands issued in it (elapsed-time queries cannot nest). GPU results are read in a later
+	// endFrame(), when they are available, without waiting. While tracing, every endFrame() appends the
+	// events of the frame to a Chrome trace-event file (chrome://tracing, Perfetto); the summary keeps
+	// the time of each scope name per frame over the last frames.
+	struct Event {
+		std::string name;
+		long long begin, end;  // ns since the profiler started, GPU times shifted onto the CPU clock
+		int track;			   // 0: GPU, threads from 1
+	};
+	struct GpuPair {
+		const char* name;
+		GLuint queries[2];
+	};
+	struct Stat {
+		std::string name;
+		double frame = 0;		 // ms in the current frame
+		std::deque<double> ms;	 // per frame, the last ones
+	};
+	static const size_t window = 120;  // frames of the summary
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::mutex mutex;  // of events, tracks and stats: CPU scopes may end on any thread
+	std::vector<Event> events;
+	std::unordered_map<std::thread::id, int> tracks;
+	std::vector<Stat> stats;
+	std::unordered_map<std::string, size_t> stat_index;
+	std::vector<GpuPair> pending;  // issued on the GL thread, in order
+	std::vector<GLuint> free_queries;
+	std::ofstream trace;
+	bool first_event = true;
+
+	int track() {  // under mutex
+		auto found = tracks.find(std::this_thread::get_id());
+		if (found != tracks.end()) return found->second;
+		int t = (int)tracks.size() + 1;
+		tracks[std::this_thread::get_id()] = t;
+		return t;
+	}
+
+	void record(std::string name, long long begin, long long end, int track) {	// under mutex
+		auto found = stat_index.find(name);
+		if (found == stat_index.end()) {
+			found = stat_index.emplace(name, stats.size()).first;
+			stats.push_back(Stat{name});
+		}
+		stats[found->second].frame += (end - begin) * 1e-6;
+		if (trace.is_open()) events.push_back(Event{std::move(name), begin, end, track});
+	}
+
+	GLuint query() {
+		if (free_queries.empty()) {
+			GLuint q[16];
+			glGenQueries(16, q);
+			free_queries.insert(free_queries.end(), q, q + 16);
+		}
+		GLuint q = free_queries.back();
+		free_queries.pop_back();
+		return q;
+	}
+
+	// the GPU pairs whose results are there, in issue order
+	void resolve() {
+		GLint64 gpu_now = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+		long long offset = now() - gpu_now;
+		size_t n = 0;
+		for (; n < pending.size(); n++) {
+			GLint available = 0;
+			glGetQueryObjectiv(pending[n].queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(pending[n].queries[0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(pending[n].queries[1], GL_QUERY_RESULT, &end);
+			std::lock_guard<std::mutex> lock(mutex);
+			record(std::string("GPU ") + pending[n].name, (long long)begin + offset, (long long)end + offset, 0);
+			free_queries.push_back(pending[n].queries[0]);
+			free_queries.push_back(pending[n].queries[1]);
+		}
+		pending.erase(pending.begin(), pending.begin() + n);
+	}
+
+	void write_events() {  // under mutex
+		for (const Event& e : events) {
+			trace << (first_event ? "\n" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+				  << e.track << ",\"ts\":" << e.begin / 1000.0 << ",\"dur\":" << (e.end - e.begin) / 1000.0 << "}";
+			first_event = false;
+		}
+		events.clear();
+	}
+
+   public:
+	std::atomic<bool> enabled{false};
+
+	long long now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// times the block it lives in; name has to outlive the profiler, a string literal
+	class Scope {
+		const char* name;
+		long long begin = 0;
+
+	   public:
+		Scope(const char* name);
+		~Scope();
+	};
+
+	// times the GL commands issued in the block it lives in, on the GL thread
+	class GpuScope {
+		GpuPair pair;
+
+	   public:
+		GpuScope(const char* name);
+		~GpuScope();
+	};
+
+	void cpu(const char* name, long long begin) {
+		long long end = now();
+		std::lock_guard<std::mutex> lock(mutex);
+		record(name, begin, end, track());
+	}
+
+	GpuPair gpuBegin(const char* name) {
+		GpuPair pair{name, {query(), query()}};
+		glQueryCounter(pair.queries[0], GL_TIMESTAMP);
+		return pair;
+	}
+
+	void gpuEnd(GpuPair pair) {
+		glQueryCounter(pair.queries[1], GL_TIMESTAMP);
+		pending.push_back(pair);
+	}
+
+	// starts writing a trace to file and enables the profiler; false if the file cannot be opened
+	bool startTrace(const std::string& file) {
+		stopTrace();
+		std::lock_guard<std::mutex> lock(mutex);
+		trace.open(file);
+		if (!trace.is_open()) return false;
+		trace << std::fixed << std::setprecision(3);	 // ts and dur in microseconds to the ns, however long the run
+		trace << "{\"traceEvents\":[";
+		first_event = true;
+		for (auto& t : tracks) {
+			trace << (first_event ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t.second
+				  << ",\"args\":{\"name\":\"thread " << t.second << "\"}}";
+			first_event = false;
+		}
+		trace << (first_event ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+		first_event = false;
+		enabled = true;
+		return true;
+	}
+
+	void stopTrace() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!trace.is_open()) return;
+		write_events();
+		trace << "\n]}\n";
+		trace.close();
+	}
+
+	bool tracing() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return trace.is_open();
+	}
+
+	// on the GL thread after the frame is drawn
+	void endFrame() {
+		if (!enabled && pending.empty()) return;
+		resolve();
+		std::lock_guard<std::mutex> lock(mutex);
+		for (Stat& s : stats) {
+			s.ms.push_back(s.frame);
+			if (s.ms.size() > window) s.ms.pop_front();
+			s.frame = 0;
+		}
+		if (trace.is_open()) write_events();
+	}
+
+	// mean and maximum ms per frame of every scope over the last frames
+	std::string summary() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::string out;
+		char line[256];
+		for (const Stat& s : stats) {
+			double sum = 0, max = 0;
+			for (double ms : s.ms) {
+				sum += ms;
+				max = std::max(max, ms);
+			}
+			snprintf(line, sizeof(line), "%-28s %8.3f ms mean %8.3f ms max\n", s.name.c_str(),
+					 s.ms.empty() ? 0.0 : sum / s.ms.size(), max);
+			out += line;
+		}
+		return out;
+	}
+};
+
+// Created on first use and never destroyed, so that no GL call runs after the context is gone.
+inline Profiler& profiler() {
+	static Profiler* p = new Profiler();
+	return *p;
+}
+
+inline Profiler::Scope::Scope(const char* name) : name(profiler().enabled ? name : nullptr) {
+	if (this->name) begin = profiler().now();
+}
+
+inline Profiler::Scope::~Scope() {
+	if (name) profiler().cpu(name, begin);
+}
+
+inline Profiler::GpuScope::GpuScope(const char* name) : pair{nullptr, {0, 0}} {
+	if (profiler().enabled) pair = profiler().gpuBegin(name);
+}
+
+inline Profiler::GpuScope::~GpuScope() {
+	if (pair.name) profiler().gpuEnd(pair);
+}
+
 enum MouseButton { MOUSE_LEFT, MOUSE_MIDDLE, MOUSE_RIGHT };
 enum SpecialKeys { KEY_RIGHT = 262, KEY_LEFT = 263, KEY_DOWN = 264, KEY_UP = 265 };
 bool pollKey(int key);
+void getFramebufferSize(int* width, int* height);	 // of the window or the headless target, in pixels
+bool offscreen();	// rendering headless: every frame is kept, none may be skipped
 
 //---------------------------
 class glApp {
@@ -385,6 +1168,9 @@ class glApp {
 	glApp(unsigned int major, unsigned int minor,		  // K�rt OpenGL major.minor verzi�
 		  unsigned int winWidth, unsigned int winHeight,  // Alkalmaz�i ablak felbont�sa
 		  const char* caption);							  // Megfog�cs�k sz�vege
+	void setFrameRate(float fps);						  // limits refreshScreen() to fps frames per second
+	void startCapture(const char* prefix);				  // writes every frame to <prefix>NNNN.png
+	void stopCapture();									  // after the last frame is written
 	void refreshScreen();								  // Ablak �rv�nytelen�t�se
 	// Esem�nykezel�k
 	virtual void onInitialization() {}	   // Inicializ�ci�
@@ -394,10 +1180,11 @@ class glApp {
 	// Eg�r gomb lenyom�s/elenged�s
 	virtual void onMousePressed(MouseButton but, int pX, int pY) {}
 	virtual void onMouseReleased(MouseButton but, int pX, int pY) {}
-	virtual void onMouseScroll(float amount, int pX, int pY) {}
+	virtual void onMouseScroll(float amount, int pX, int pY) {}  // amount: the steps since the last call
 
 	// Eg�r mozgat�s lenyomott gombbal
-	virtual void onMouseMotion(int pX, int pY) {}
+	virtual void onMouseMotion(int pX, int pY) {}  // at most once per frame, with the last position
 	// Telik az id�
 	virtual void onTimeElapsed(float startTime, float endTime) {}
+	virtual void onClose() {}  // before the context and the static objects go away
 };
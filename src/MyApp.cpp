@@ -1,14 +1,24 @@
 #include "../include/framework.h"
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <unordered_map>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 const char* vert_source = R"(
 	#version 330				
-    uniform mat4 MVP;
+	layout(std140) uniform CameraBlock {	// written by Camera::upload
+		mat4 view;
+		mat4 projection;
+	};
+	uniform mat4 model;
 	layout(location = 0) in vec2 vertexPosition;
+	layout(location = 1) in vec2 instanceOffset;	// (0, 0) unless an instance array is bound
 
 	void main() {
-		gl_Position = MVP * vec4(vertexPosition, 0, 1);
+		gl_Position = projection * view * model * vec4(vertexPosition + instanceOffset, 0, 1);
 	}
 )";
 
@@ -22,6 +32,142 @@ const char* fragSource = R"(
 	}
 )";
 
+// Cones generated entirely on the GPU: every vertex is computed from gl_VertexID and the apex, mass
+// and branch length of its instance with the same closed form as ConeGeometry::sample_tortoise.
+// Branches are drawn as GL_LINES, 2 * fid vertices per branch, arrowheads as 6 vertices per instance.
+const char* cone_vert_source = R"(
+	#version 330
+	layout(std140) uniform CameraBlock {
+		mat4 view;
+		mat4 projection;
+	};
+	uniform mat4 model;
+	uniform float scale;	// multiplies every branch length
+	uniform int fid;		// segments per branch
+	uniform bool arrows;	// arrowheads instead of branches
+	uniform bool ef;		// ingoing Eddington-Finkelstein time instead of the Schwarzschild one
+	layout(location = 1) in float r0;
+	layout(location = 2) in float t0;
+	layout(location = 3) in float M;
+	layout(location = 4) in float len;
+
+	const vec4 culled = vec4(0, 0, 2, 1);
+
+	vec4 clip(vec2 p) {
+		return projection * view * model * vec4(p, 0, 1);
+	}
+
+	float chord(float r, float w0, float c) {
+		return length(vec2(r - r0, r - r0 + c * 2 * M * (log(abs(r - 2 * M)) - w0)));
+	}
+
+	vec4 arrow(vec2 tip, vec2 dir) {
+		dir *= len * scale * 0.2;
+		int c = gl_VertexID % 3;
+		tip += (c == 0) ? dir : (c == 1) ? vec2(dir.y, -dir.x) : vec2(-dir.y, dir.x);
+		return clip(tip);
+	}
+
+	void main() {
+		float L = len * scale;
+		int k = arrows ? (gl_VertexID / 3) * 2 : gl_VertexID / (2 * fid);	// branch
+		int i = arrows ? fid : (gl_VertexID % (2 * fid) + 1) / 2;			// vertex on the branch
+		float kappa = (k < 2) ? 1.0 : -1.0;
+		float sign = (k % 2 == 0) ? 1.0 : -1.0;
+		bool horizon = abs(r0 - 2 * M) < 0.00001;
+
+		if (horizon && !ef) {	// on the horizon the cone is a single vertical segment
+			gl_Position = (arrows || k != 0) ? culled : clip(vec2(r0, t0 - L + 2 * L * i / fid));
+			return;
+		}
+		if (ef && (k >= 2 || horizon)) {	// straight branches: the ingoing ones and the horizon generator
+			vec2 dir = sign * normalize((k < 2) ? vec2(0, 1) : vec2(-1, 1));
+			float l = (dir.x < 0) ? min(L, r0 / -dir.x) : L;
+			if (arrows) {
+				gl_Position = (l < L) ? culled : arrow(vec2(r0, t0) + dir * l, dir);
+			} else {
+				gl_Position = clip(vec2(r0, t0) + dir * (l * i / fid));
+			}
+			return;
+		}
+
+		float side = (r0 > 2 * M) ? 1.0 : -1.0;
+		float sr = (k < 2) ? sign * side : -sign;
+		float c = ef ? 2.0 : kappa;	// t = t0 + kappa (r - r0) + c 2M (w - w0)
+
+		float r_lim = r0 + sr * L;
+		if (sr < 0) r_lim = max(r_lim, 0.0);
+		if (side > 0 && sr < 0) r_lim = max(r_lim, 2 * M);
+		if (side < 0 && sr > 0) r_lim = min(r_lim, 2 * M);
+
+		float w0 = log(abs(r0 - 2 * M));
+		bool complete = r_lim == 2 * M || chord(r_lim, w0, c * kappa) >= L;
+		float r_end = r_lim;
+		if (complete) {
+			float a = r0, b = r_lim;
+			for (int j = 0; j < 24; j++) {
+				float m = (a + b) / 2;
+				if (chord(m, w0, c * kappa) < L) a = m;
+				else b = m;
+			}
+			r_end = a;
+		}
+
+		float dw = (log(abs(r_end - 2 * M)) - w0) / fid;
+		float r = 2 * M + side * exp(w0 + i * dw);
+		vec2 p = vec2(r, t0 + kappa * (r - r0) + c * 2 * M * (i * dw));
+		if (arrows) {
+			float slope = kappa + c * 2 * M / (r_end - 2 * M);	// dt/dr along the branch
+			gl_Position = complete ? arrow(p, normalize(vec2(sr, sr * slope))) : culled;
+			return;
+		}
+		gl_Position = clip(p);
+	}
+)";
+
+// The r and t coordinate lines on one full-screen quad. Each fragment finds its distance to the nearest
+// lines from its world position, so the cost does not depend on how many lines are in view. Lines come
+// in decades: the finest decade not closer than min_spacing pixels fades in as the zoom spreads it out,
+// and takes over from the one above when that gets too close in turn.
+const char* grid_vert_source = R"(
+	#version 330
+	layout(std140) uniform CameraBlock {
+		mat4 view;
+		mat4 projection;
+	};
+	out vec2 world;
+
+	void main() {
+		vec2 clip = vec2((gl_VertexID & 1) * 2 - 1, (gl_VertexID >> 1) * 2 - 1);	// GL_TRIANGLE_STRIP
+		world = (inverse(projection * view) * vec4(clip, 0, 1)).xy;
+		gl_Position = vec4(clip, 0, 1);
+	}
+)";
+
+const char* grid_frag_source = R"(
+	#version 330
+	uniform vec4 color;
+	uniform float min_spacing;	// in pixels
+	in vec2 world;
+	out vec4 fragmentColor;
+
+	// coverage of the pixel by one pixel wide lines at the multiples of s, px: size of the pixel in world units
+	vec2 lines(vec2 s, vec2 px) {
+		vec2 d = abs(fract(world / s + 0.5) - 0.5) * s / px;	// to the nearest line, in pixels
+		return clamp(1.0 - d, 0.0, 1.0);
+	}
+
+	void main() {
+		vec2 px = fwidth(world);
+		vec2 level = log(min_spacing * px) / log(10.0);
+		vec2 fine = pow(vec2(10.0), ceil(level));
+		vec2 fade = ceil(level) - level;	// 0 where the fine lines are min_spacing apart, 1 at ten times that
+		vec2 cover = max(lines(10.0 * fine, px), lines(fine, px) * fade);
+		float a = max(cover.x, cover.y) * step(-0.5 * px.x, world.x);	// r >= 0 only
+		fragmentColor = vec4(color.rgb * a, 1);	// drawn first, over black
+	}
+)";
+
 const float R = 40000;
 const int winWidth = 600, winHeight = 600;
 
@@ -34,6 +180,8 @@ class Camera {
    protected:
 	vec2 pos;
 	vec2 size;
+	unsigned int ubo = 0;  // view and projection as the shaders' CameraBlock; lives as long as the context
+	vec2 uploaded_pos, uploaded_size;
 
    public:
 	Camera(vec2 pos, vec2 size) : pos(pos), size(size) {}
@@ -51,10 +199,41 @@ class Camera {
 		return scale(vec3(size.x / 2, size.y / 2, 1));
 	}
 
+	static const int block_binding = 0;	 // of CameraBlock, see GPUProgram::bindBlock
+
+	// writes view and projection to the uniform buffer if the camera moved since the last call
+	void upload() {
+		if (ubo == 0) {
+			glGenBuffers(1, &ubo);
+			glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+			glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(mat4), NULL, GL_DYNAMIC_DRAW);
+			glBindBufferBase(GL_UNIFORM_BUFFER, block_binding, ubo);
+		} else if (pos == uploaded_pos && size == uploaded_size) {
+			return;
+		}
+		uploaded_pos = pos;
+		uploaded_size = size;
+		mat4 block[2] = {View(), Projection()};	 // std140 lays out a mat4 as 4 vec4 columns, as glm does
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), block);
+	}
+
+	// the same view, whether uploaded or not
+	bool operator==(const Camera& c) const {
+		return pos == c.pos && size == c.size;
+	}
+
 	float get_size() {
 		return length(size) / sqrt(2);
 	}
 
+	// in framebuffer pixels, the ones the grid spacing is measured in too
+	float pixels_per_unit() {
+		int width, height;
+		getFramebufferSize(&width, &height);
+		return width / size.x;
+	}
+
 	void addOrigo(vec2 v) {
 		pos += v;
 	}
@@ -72,13 +251,84 @@ class Camera {
 	}
 };
 
+// A non-owning view of vertices: Object::bind and updateGPU read them where they are, without a copy.
+template <class T>
+struct Span {
+	const T* data;
+	size_t size;
+	Span(const T* data, size_t size) : data(data), size(size) {}
+	Span(const std::vector<T>& vec) : data(vec.data()), size(vec.size()) {}
+};
+
+template <class T>
+struct Part;
+
+// Vertices drawn over several frames. Changes go through edit(), which bumps the revision, so that
+// Object::bind pushes them into streamBuffer() again only when they changed.
+template <class T>
+class VertexArray {
+	std::vector<T> vtx;
+	unsigned long long revision = 1;
+	unsigned long long mirrored = 0;  // revision of the Part last copied by mirror()
+
+   public:
+	VertexArray() = default;
+	VertexArray(const VertexArray&) = delete;
+	VertexArray& operator=(const VertexArray&) = delete;
+
+	const std::vector<T>& get() const {
+		return vtx;
+	}
+	std::vector<T>& edit() {
+		revision++;
+		return vtx;
+	}
+	size_t size() const {
+		return vtx.size();
+	}
+	unsigned long long get_revision() const {
+		return revision;
+	}
+	// the vertices of a snapshot, copied only when they are newer than the last ones taken
+	void mirror(const Part<T>& part) {
+		if (part.revision == mirrored) return;
+		edit() = part.data;
+		mirrored = part.revision;
+	}
+};
+
+// Vertices as they were when a snapshot was taken. take() copies the source only when its revision
+// moved since, so a snapshot costs a copy of what changed, not of everything.
+template <class T>
+struct Part {
+	std::vector<T> data;
+	unsigned long long revision = 0;
+
+	bool take(const std::vector<T>& source, unsigned long long source_revision) {
+		if (source_revision == revision) return false;
+		data = source;
+		revision = source_revision;
+		return true;
+	}
+	bool take(const VertexArray<T>& source) {
+		return take(source.get(), source.get_revision());
+	}
+};
+
 template <class T>
 class Object {
    protected:
 	unsigned int vao{}, vbo[1];
 	vec4 color = vec4(1.0f, 0.0f, 0.0f, 1.0f);
-	float phi = 0;
-	vec3 scaling = vec3(1, 1, 0), pos = vec3(0, 0, 0);
+	mat4 model = mat4(1.0f);  // places the object in the world, the camera is in CameraBlock
+	StreamBuffer::Allocation streamed;	// of what bind() got last
+
+	// looked up again when the object is drawn with another program
+	struct Uniforms {
+		GPUProgram* prog = nullptr;
+		Uniform<mat4> model;
+		Uniform<vec4> color;
+	} uniforms;
 
    public:
 	Object() {
@@ -90,28 +340,104 @@ class Object {
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
 	}
-	void updateGPU(std::vector<T> vec) {
+	// for data kept on the GPU; what bind() gets is streamed instead
+	void updateGPU(Span<T> vec) {
+		glBindVertexArray(vao);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
-		glBufferData(GL_ARRAY_BUFFER, vec.size() * sizeof(T), vec.data(), GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, vec.size * sizeof(T), vec.data, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
 	}
 	void Bind() {
 		glBindVertexArray(vao);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
 	}
-	void draw(GPUProgram* prog, int type, Camera& camera, std::vector<T> vec, vec4 color) {
-		if (vec.size() > 0) {
-			updateGPU(vec);	 // not here
-			mat4 M = translate(pos) * rotate(phi, vec3(0, 0, 1)) * scale(scaling);
-			mat4 MVP = camera.Projection() * camera.View() * M;
-			prog->Use();
-			prog->setUniform(MVP, "MVP");
-			prog->setUniform(color, "color");
-			glBindVertexArray(vao);
-			glDrawArrays(type, 0, (int)vec.size());
+	void setUniforms(GPUProgram* prog, Camera& camera, vec4 color) {
+		camera.upload();
+		prog->Use();
+		if (uniforms.prog != prog) {
+			uniforms.prog = prog;
+			uniforms.model = prog->uniform<mat4>("model");
+			uniforms.color = prog->uniform<vec4>("color");
+		}
+		uniforms.model.set(model);
+		uniforms.color.set(color);
+	}
+	// binds the vao with the vertex attribute at vtx in streamBuffer(); vtx is pushed again only when its
+	// revision moved or the ring moved past the last push
+	void bind(Span<T> vtx, unsigned long long revision) {
+		glBindVertexArray(vao);
+		size_t offset = streamBuffer().update(streamed, vtx.data, vtx.size * sizeof(T), revision);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)offset);
+	}
+};
+
+// The lines, line strips and triangles of one layer of the frame in a single buffer, drawn with one
+// glMultiDrawArrays per style. Styles are drawn in the order they were first added, so a later primitive
+// of an earlier style goes below the ones added in between. The sources are added again every frame, and
+// the buffer is rebuilt only when one of them changed.
+class LineBatch : public Object<vec2> {
+	struct Source {
+		const VertexArray<vec2>* vtx;
+		unsigned long long revision;
+		size_t first, count;
+		int type;
+		vec4 color;
+		float width;
+		bool operator==(const Source& s) const {
+			return vtx == s.vtx && revision == s.revision && first == s.first && count == s.count && type == s.type &&
+				   color == s.color && width == s.width;
+		}
+	};
+	struct Style {
+		int type;
+		vec4 color;
+		float width;
+		std::vector<GLint> first;
+		std::vector<GLsizei> count;
+	};
+	std::vector<Source> sources, built;	 // of this frame and of the buffer
+	std::vector<Style> styles;
+	VertexArray<vec2> vtx;
+
+	void build() {
+		std::vector<vec2>& v = vtx.edit();
+		v.clear();
+		styles.clear();
+		for (const Source& src : sources) {
+			auto style = std::find_if(styles.begin(), styles.end(), [&](const Style& s) {
+				return s.type == src.type && s.color == src.color && s.width == src.width;
+			});
+			if (style == styles.end()) {
+				styles.push_back(Style{src.type, src.color, src.width, {}, {}});
+				style = styles.end() - 1;
+			}
+			style->first.push_back((GLint)v.size());
+			style->count.push_back((GLsizei)src.count);
+			const vec2* data = src.vtx->get().data() + src.first;
+			v.insert(v.end(), data, data + src.count);
 		}
+		built = sources;
 	}
-	void draw(GPUProgram* prog, int type, Camera& camera, std::vector<T> vec) {
-		draw(prog, type, camera, vec, color);
+
+   public:
+	// count vertices of vtx from first; vtx has to live until draw()
+	void add(const VertexArray<vec2>& vtx, int type, vec4 color, float width, size_t first = 0,
+			 size_t count = ~size_t(0)) {
+		count = std::min(count, vtx.size() - std::min(first, vtx.size()));
+		if (count > 0) sources.push_back(Source{&vtx, vtx.get_revision(), first, count, type, color, width});
+	}
+
+	// draws what was added since the last call
+	void draw(GPUProgram* prog, Camera& camera) {
+		if (sources != built) build();
+		sources.clear();
+		if (vtx.size() == 0) return;
+		bind(vtx.get(), vtx.get_revision());
+		for (const Style& s : styles) {
+			setUniforms(prog, camera, s.color);
+			glLineWidth(s.width);
+			glMultiDrawArrays(s.type, s.first.data(), s.count.data(), (GLsizei)s.first.size());
+		}
 	}
 };
 
@@ -123,113 +449,601 @@ float Deg(float rad) {
 	return rad / (2 * M_PI) * 360.0f;
 }
 
-class Cone : public Object<vec2> {
+enum INTEGRATOR {
+	EULER,
+	DOPRI,
+	TORTOISE,
+	SHADER	// TORTOISE evaluated in the vertex shader, see cone_vert_source
+};
+
+enum COORDINATES {
+	SCHWARZSCHILD,
+	EDDINGTON_FINKELSTEIN  // ingoing, t = t_S + r* - r: the null directions stay finite at the horizons
+};
+
+// Static, spherically symmetric spacetimes ds^2 = -f dt^2 + dr^2 / f + r^2 dOmega^2 of mass M, q being the
+// second parameter where there is one. They are template arguments of the cone code, so f inlines into the
+// steppers. roots() gives the zeros of f, unphysical negative ones included, and far the limit of 1/f at
+// infinity; together they give 1/f = far + sum 1 / (f'(r_i) (r - r_i)), see tortoise_shift.
+struct Schwarzschild {
+	static constexpr bool closed_form = true;  // see ConeGeometry::sample_tortoise
+	static constexpr float far = 1;
+	static float f(float r, float M, float) {
+		return 1 - 2 * M / r;
+	}
+	static float df(float r, float M, float) {
+		return 2 * M / (r * r);
+	}
+	static int roots(float M, float, float out[3]) {
+		out[0] = 2 * M;
+		return 1;
+	}
+	// whether the future points outwards where f < 0
+	static bool expanding(float, float, float) {
+		return false;
+	}
+};
+
+struct ReissnerNordstrom {	// q is the charge, |q| < M
+	static constexpr bool closed_form = false;
+	static constexpr float far = 1;
+	static float f(float r, float M, float q) {
+		return 1 - 2 * M / r + q * q / (r * r);
+	}
+	static float df(float r, float M, float q) {
+		return 2 * M / (r * r) - 2 * q * q / (r * r * r);
+	}
+	static int roots(float M, float q, float out[3]) {
+		if (q * q >= M * M) return 0;
+		float d = sqrt(M * M - q * q);
+		out[0] = M + d;
+		out[1] = M - d;
+		return 2;
+	}
+	static bool expanding(float, float, float) {
+		return false;
+	}
+};
+
+struct SchwarzschildDeSitter {	// q is the cosmological constant, 0 < 9 q M^2 < 1; de Sitter itself for M = 0
+	static constexpr bool closed_form = false;
+	static constexpr float far = 0;
+	static float f(float r, float M, float q) {
+		return 1 - 2 * M / r - q * r * r / 3;
+	}
+	static float df(float r, float M, float q) {
+		return 2 * M / (r * r) - 2 * q * r / 3;
+	}
+	// r f = 0 is the depressed cubic r^3 - (3 / q) r + 6M / q = 0, solved trigonometrically; its root at
+	// r = 0 for M = 0 is not a zero of f
+	static int roots(float M, float q, float out[3]) {
+		double a = 2 * sqrt(1 / (double)q), c = acos(fmin(fmax(-3 * M * sqrt((double)q), -1.0), 1.0)) / 3;
+		int n = 0;
+		for (int k = 0; k < 3; k++) {
+			double r = a * cos(c - 2 * M_PI * k / 3);
+			if (fabs(r) > 1e-6) out[n++] = (float)r;
+		}
+		return n;
+	}
+	static bool expanding(float r, float M, float q) {
+		return df(r, M, q) < 0;	 // beyond the cosmological horizon
+	}
+};
+
+struct Minkowski {
+	static constexpr bool closed_form = false;
+	static constexpr float far = 1;
+	static float f(float, float, float) {
+		return 1;
+	}
+	static float df(float, float, float) {
+		return 0;
+	}
+	static int roots(float, float, float[3]) {
+		return 0;
+	}
+	static bool expanding(float, float, float) {
+		return false;
+	}
+};
+
+enum METRIC {
+	SCHWARZSCHILD_METRIC,
+	REISSNER_NORDSTROM_METRIC,
+	DE_SITTER_METRIC,
+	MINKOWSKI_METRIC
+};
+
+struct Spacetime {
+	METRIC metric = SCHWARZSCHILD_METRIC;
+	float q = 0;
+	bool operator==(const Spacetime& s) const {
+		return metric == s.metric && q == s.q;
+	}
+	bool operator!=(const Spacetime& s) const {
+		return !(*this == s);
+	}
+};
+
+// calls f with a value of the policy type of metric: the only runtime dispatch, done once per regeneration
+template <class F>
+auto with_metric(METRIC metric, F&& f) {
+	switch (metric) {
+		case REISSNER_NORDSTROM_METRIC:
+			return f(ReissnerNordstrom());
+		case DE_SITTER_METRIC:
+			return f(SchwarzschildDeSitter());
+		case MINKOWSKI_METRIC:
+			return f(Minkowski());
+		default:
+			return f(Schwarzschild());
+	}
+}
+
+// the horizons, the positive roots of f
+template <class Metric>
+int horizons(float M, float q, float out[3]) {
+	float r[3];
+	int n = 0;
+	for (int i = 0, roots = Metric::roots(M, q, r); i < roots; i++) {
+		if (r[i] > 0) out[n++] = r[i];
+	}
+	return n;
+}
+
+inline int horizons(const Spacetime& s, float M, float out[3]) {
+	return with_metric(s.metric, [&](auto metric) { return horizons<decltype(metric)>(M, s.q, out); });
+}
+
+// r* - r, r* = integral of 1/f dr being the tortoise coordinate: ingoing Eddington-Finkelstein time is
+// t + tortoise_shift(r). For Schwarzschild it is 2M ln|r / 2M - 1|.
+template <class Metric>
+float tortoise_shift(float r, float M, float q) {
+	float roots[3];
+	float shift = (Metric::far - 1) * r;
+	for (int i = 0, n = Metric::roots(M, q, roots); i < n; i++) {
+		shift += log(fabs(r / roots[i] - 1)) / Metric::df(roots[i], M, q);
+	}
+	return shift;
+}
+
+inline float tortoise_shift(const Spacetime& s, float r, float M) {
+	return with_metric(s.metric, [&](auto metric) { return tortoise_shift<decltype(metric)>(r, M, s.q); });
+}
+
+#ifdef __SSE2__
+// exp of four floats at once (Cephes polynomial), within a few ulp of expf
+inline __m128 exp_ps(__m128 x) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	x = _mm_min_ps(x, _mm_set1_ps(88.3762626647949f));
+	x = _mm_max_ps(x, _mm_set1_ps(-88.3762626647949f));
+
+	__m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+	__m128 tmp = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+	fx = _mm_sub_ps(tmp, _mm_and_ps(_mm_cmpgt_ps(tmp, fx), one));  // floor
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+
+	__m128 z = _mm_mul_ps(x, x);
+	__m128 y = _mm_set1_ps(1.9875691500e-4f);
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+	y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, z), x), one);
+
+	__m128i e = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127)), 23);
+	return _mm_mul_ps(y, _mm_castsi128_ps(e));
+}
+
+// natural log of four positive floats at once (Cephes polynomial)
+inline __m128 log_ps(__m128 x) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	x = _mm_max_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x00800000)));  // smallest normal
+
+	__m128i emm0 = _mm_srli_epi32(_mm_castps_si128(x), 23);
+	x = _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(~0x7f800000)));
+	x = _mm_or_ps(x, _mm_set1_ps(0.5f));
+	__m128 e = _mm_add_ps(_mm_cvtepi32_ps(_mm_sub_epi32(emm0, _mm_set1_epi32(0x7f))), one);
+
+	__m128 mask = _mm_cmplt_ps(x, _mm_set1_ps(0.707106781186547524f));
+	__m128 tmp = _mm_and_ps(x, mask);
+	x = _mm_sub_ps(x, one);
+	e = _mm_sub_ps(e, _mm_and_ps(one, mask));
+	x = _mm_add_ps(x, tmp);
+
+	__m128 z = _mm_mul_ps(x, x);
+	__m128 y = _mm_set1_ps(7.0376836292e-2f);
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(-1.1514610310e-1f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.1676998740e-1f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(-1.2420140846e-1f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.4249322787e-1f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(-1.6668057665e-1f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(2.0000714765e-1f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(-2.4999993993e-1f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(3.3333331174e-1f));
+	y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+	y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(-2.12194440e-4f)));
+	y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+	return _mm_add_ps(_mm_add_ps(x, y), _mm_mul_ps(e, _mm_set1_ps(0.693359375f)));
+}
+#endif
+
+// Bisects the four branches of the cone at r0 at once: for each lane, the r between r0 and hi[k] at
+// which the chord |(r - r0, r - r0 + c 2M (w - w0))| from the apex reaches len, w = ln|r - 2M|.
+void chord_bisect4(float r0, float M, float len, float c, const float hi[4], float out[4]) {
+	const int iterations = 24;
+#ifdef __SSE2__
+	const __m128 r0v = _mm_set1_ps(r0), m2 = _mm_set1_ps(2 * M), len2 = _mm_set1_ps(len * len);
+	const __m128 cm2 = _mm_set1_ps(c * 2 * M);
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 w0 = log_ps(_mm_and_ps(_mm_sub_ps(r0v, m2), abs_mask));
+	__m128 a = r0v, b = _mm_loadu_ps(hi);
+	for (int i = 0; i < iterations; i++) {
+		__m128 m = _mm_mul_ps(_mm_add_ps(a, b), _mm_set1_ps(0.5f));
+		__m128 dr = _mm_sub_ps(m, r0v);
+		__m128 w = log_ps(_mm_and_ps(_mm_sub_ps(m, m2), abs_mask));
+		__m128 dt = _mm_add_ps(dr, _mm_mul_ps(cm2, _mm_sub_ps(w, w0)));
+		__m128 shorter = _mm_cmplt_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dt, dt)), len2);
+		a = _mm_or_ps(_mm_and_ps(shorter, m), _mm_andnot_ps(shorter, a));
+		b = _mm_or_ps(_mm_andnot_ps(shorter, m), _mm_and_ps(shorter, b));
+	}
+	_mm_storeu_ps(out, a);
+#else
+	float w0 = log(fabs(r0 - 2 * M));
+	for (int k = 0; k < 4; k++) {
+		float a = r0, b = hi[k];
+		for (int i = 0; i < iterations; i++) {
+			float m = (a + b) / 2;
+			float dt = m - r0 + c * 2 * M * (log(fabs(m - 2 * M)) - w0);
+			if ((m - r0) * (m - r0) + dt * dt < len * len) a = m;
+			else b = m;
+		}
+		out[k] = a;
+	}
+#endif
+}
+
+// n vertices of a closed form branch through the apex (r0, t0): vertex i sits at w = w0 + i * dw,
+// r = 2M + side * e^w, t = t0 + kappa * (r - r0) + c * 2M * (w - w0). Four vertices per iteration where
+// SSE2 is available.
+void tortoise_kernel(vec2* out, int n, float r0, float t0, float M, float w0, float dw, float side,
+					 float kappa, float c) {
+	int i = 0;
+#ifdef __SSE2__
+	const __m128 m2 = _mm_set1_ps(2 * M), cm2 = _mm_set1_ps(c * 2 * M), r0v = _mm_set1_ps(r0);
+	const __m128 t0v = _mm_set1_ps(t0), w0v = _mm_set1_ps(w0), dwv = _mm_set1_ps(dw);
+	const __m128 sidev = _mm_set1_ps(side), kappav = _mm_set1_ps(kappa);
+	__m128 idx = _mm_setr_ps(0, 1, 2, 3);
+	for (; i + 4 <= n; i += 4) {
+		__m128 dwi = _mm_mul_ps(idx, dwv);	// w - w0
+		__m128 r = _mm_add_ps(m2, _mm_mul_ps(sidev, exp_ps(_mm_add_ps(w0v, dwi))));
+		__m128 t = _mm_add_ps(t0v, _mm_add_ps(_mm_mul_ps(kappav, _mm_sub_ps(r, r0v)), _mm_mul_ps(cm2, dwi)));
+		float* dst = &out[i].x;
+		_mm_storeu_ps(dst, _mm_unpacklo_ps(r, t));
+		_mm_storeu_ps(dst + 4, _mm_unpackhi_ps(r, t));
+		idx = _mm_add_ps(idx, _mm_set1_ps(4));
+	}
+#endif
+	for (; i < n; i++) {
+		float r = 2 * M + side * exp(w0 + i * dw);
+		out[i] = vec2(r, t0 + kappa * (r - r0) + c * 2 * M * (i * dw));
+	}
+}
+
+// The four null branches of the light cone at p: vtx[0] and vtx[1] run along the outgoing (plus), vtx[2]
+// and vtx[3] along the ingoing (minus) null curve, into the future and the past respectively.
+// Holds no GPU state, so it can be generated anywhere.
+class ConeGeometry {
 	vec2 p;
 	float M;
+	float len = 0.5f;
+	INTEGRATOR integrator = EULER;
+	float tolerance = 1e-3f;  // allowed local error of a DOPRI step, relative to the branch length
+	COORDINATES coords = SCHWARZSCHILD;
+	Spacetime spacetime;
+	int segments = fid;	 // per branch, a level of lod()
 
-	float const fid = 100;
-	float length = 0.5f;
+   public:
+	static constexpr float fid = 100;		   // segments per branch at the finest level
+	static constexpr int min_segments = 3;	   // at the coarsest
+	static constexpr float pixel_error = 0.5f;  // allowed distance of a branch from the curve on screen
 	std::vector<std::vector<vec2>> vtx;
 	std::vector<vec2> triangle_vtx;
-	Camera* cam;
-	bool relative = false;
+
+	// closed form description of a branch, see sample_tortoise
+	struct TortoiseBranch {
+		float side, kappa;	// side of the horizon, sign of dt along the curve
+		float c;			// t = t0 + kappa (r - r0) + c 2M (w - w0)
+		float w0, dw;		// w = ln|r - 2M| of the apex and its step between vertices
+		vec2 end, dir;		// tip of the branch and the tangent there
+		bool complete;		// false if the branch runs into the singularity first
+		bool straight;		// a line, vertex i at apex + i * step; only in Eddington-Finkelstein time
+		vec2 step;
+		int segments;
+	};
+
+   private:
+	TortoiseBranch tortoise[4];
 
    public:
-	Cone(float M, vec2 p, Camera& cam, bool relative = false) : M(M), p(p), cam(&cam), relative(relative){
-		color = vec4(1.0f, 1.0f, 0.0f, 1.0f);
-		for (int i = 0; i < 4; i++) {
-			vtx.push_back(std::vector<vec2>());
+
+	ConeGeometry() : vtx(4) {}
+
+	// Segments per branch for a branch the given number of pixels long: the fewest fid / 2^k that keep it
+	// within pixel_error of the curve, taking a quarter turn along the branch. The error of Euler steps is
+	// first order in the step, that of chords of the exact curve second order.
+	static int lod(float pixels, INTEGRATOR integrator) {
+		float turn = M_PI / 2;
+		float n = (integrator == EULER) ? pixels * turn / (2 * pixel_error) : sqrt(pixels * turn / (8 * pixel_error));
+		int segments = fid;
+		while (segments / 2 >= n && segments / 2 >= min_segments) {
+			segments /= 2;
 		}
-		update(relative);
+		return segments;
 	}
 
+	void generate(float M, vec2 p, float len, INTEGRATOR integrator = EULER, float tolerance = 1e-3f,
+				  COORDINATES coords = SCHWARZSCHILD, Spacetime spacetime = Spacetime(), int segments = fid) {
+		place(M, p, len, integrator, tolerance, coords, spacetime, segments);
+		generate();
+	}
 
-	void update(bool relative) {
-		this->relative = relative;
+	// sets the apex and the parameters and clears the branches, without generating them
+	void place(float M, vec2 p, float len, INTEGRATOR integrator = EULER, float tolerance = 1e-3f,
+			   COORDINATES coords = SCHWARZSCHILD, Spacetime spacetime = Spacetime(), int segments = fid) {
+		this->M = M;
+		this->p = p;
+		this->len = len;
+		this->integrator = (integrator == SHADER) ? TORTOISE : integrator;	 // same curves on the CPU
+		if (this->integrator == TORTOISE && spacetime.metric != SCHWARZSCHILD_METRIC) {
+			this->integrator = DOPRI;  // no closed form
+		}
+		this->tolerance = tolerance;
+		this->coords = coords;
+		this->spacetime = spacetime;
+		this->segments = segments;
 		clear();
-		if (floatCmp(2 * M, p.x)) {
+	}
+
+	void generate() {
+		with_metric(spacetime.metric, [this](auto metric) { generate<decltype(metric)>(); });
+	}
+
+	template <class Metric>
+	void generate() {
+		if (p.x < 0) return;  // beyond the singularity: no branches, as the marches stop there at once
+		if (is_horizon<Metric>()) {
 			create_horizon_segment();
 		} else {
-			create_plus_segment();
-			create_minus_segment();
+			if constexpr (Metric::closed_form) {
+				if (integrator == TORTOISE) tortoise_branches(tortoise);
+			}
+			create_branch<Metric>(vtx[0], true, 1.0f);
+			create_branch<Metric>(vtx[1], true, -1.0f);
+			create_branch<Metric>(vtx[2], false, 1.0f);
+			create_branch<Metric>(vtx[3], false, -1.0f);
+		}
+	}
+
+	// whether the branches come from sample_tortoise
+	bool is_closed_form() {
+		return integrator == TORTOISE;
+	}
+
+	// only Schwarzschild time needs the apexes on a horizon handled apart
+	bool is_horizon() {
+		return with_metric(spacetime.metric, [this](auto metric) { return is_horizon<decltype(metric)>(); });
+	}
+
+	template <class Metric>
+	bool is_horizon() {
+		if (coords != SCHWARZSCHILD) return false;
+		float r[3];
+		for (int i = 0, n = horizons<Metric>(M, spacetime.q, r); i < n; i++) {
+			if (floatCmp(r[i], p.x)) return true;
 		}
+		return false;
 	}
+
 	void create_horizon_segment() {
 		vtx[0].push_back(vec2(p.x, p.y - get_len()));
 		vtx[0].push_back(vec2(p.x, p.y + get_len()));
 	}
 
-	void create_plus_segment() {
-		vec2 c = p;
-		vec2 dir;
-		int i;
-		for (i = 0; i < fid; i++) {
-			if (c.x < 0) break;
-			vtx[0].push_back(vec2(c.x, c.y));
-			dir = ((ddt(M, c.x) < 1) ? -1.0f : 1.0f) * normalize(vec2(1.0f, ddt(M, c.x)));
-			c = c + (dir * get_len() / fid);
+	// Unit tangent of the outgoing (plus) or ingoing (minus) null curve through r, dt/dr = +-1/f. Where
+	// f < 0 the future is towards the singularity, or away from it beyond a cosmological horizon.
+	template <class Metric>
+	vec2 direction(float r, bool plus) {
+		float f = Metric::f(r, M, spacetime.q);
+		float future = (f < 0 && Metric::expanding(r, M, spacetime.q)) ? -1.0f : 1.0f;
+		if (coords == EDDINGTON_FINKELSTEIN) {
+			return future * (plus ? normalize(vec2(f, 2 - f)) : normalize(vec2(-1.0f, 1.0f)));
 		}
-		if (i == fid) {
-			dir *= get_arrow_size();
-			triangle_vtx.push_back(vec2(c.x, c.y) + dir);
-			triangle_vtx.push_back(vec2(c.x, c.y) + vec2(dir.y, -dir.x));
-			triangle_vtx.push_back(vec2(c.x, c.y) + vec2(-dir.y, dir.x));
+		return future * (plus ? normalize(vec2(f, 1.0f)) : normalize(vec2(-1.0f, 1 / f)));
+	}
+
+	// sign = 1 marches into the future and gets an arrowhead, sign = -1 into the past
+	template <class Metric>
+	void create_branch(std::vector<vec2>& out, bool plus, float sign) {
+		vec2 c, dir;
+		bool complete;
+		switch (integrator) {
+			case DOPRI:
+				complete = march_dopri<Metric>(out, plus, sign, c, dir);
+				break;
+			case TORTOISE:
+				complete = sample_tortoise(out, plus, sign, c, dir);
+				break;
+			default:
+				complete = march_euler<Metric>(out, plus, sign, c, dir);
+				break;
+		}
+		if (complete && sign > 0) {
+			add_arrow(c, dir);
 		}
+	}
 
+	void add_arrow(vec2 c, vec2 dir) {
+		dir *= get_arrow_size();
+		triangle_vtx.push_back(vec2(c.x, c.y) + dir);
+		triangle_vtx.push_back(vec2(c.x, c.y) + vec2(dir.y, -dir.x));
+		triangle_vtx.push_back(vec2(c.x, c.y) + vec2(-dir.y, dir.x));
+	}
+
+	template <class Metric>
+	bool march_euler(std::vector<vec2>& out, bool plus, float sign, vec2& c, vec2& dir) {
 		c = p;
-		for (i = 0; i < fid; i++) {
-			if (c.x < 0) break;
-			vtx[1].push_back(vec2(c.x, c.y));
-			dir = ((ddt(M, c.x) < 1) ? -1.0f : 1.0f) * normalize(vec2(1.0f, ddt(M, c.x)));
-			c = c - (dir * get_len() / fid);
+		for (int i = 0; i < segments; i++) {
+			if (c.x < 0) return false;
+			out.push_back(vec2(c.x, c.y));
+			dir = sign * direction<Metric>(c.x, plus);
+			c = c + (dir * get_len() / (float)segments);
 		}
+		return true;
 	}
 
-	void create_minus_segment() {
-		vec2 c = p;
-		vec2 dir;
-		int i;
-		for (i = 0; i < fid; i++) {
-			if (c.x < 0) break;
-			vtx[2].push_back(vec2(c.x, c.y));
-			dir = ((ddt(M, c.x) < 1) ? 1.0f : 1.0f) * normalize(vec2(-1.0f, ddt(M, c.x)));
-			c = c + (dir * get_len() / fid);
-		}
-		if (i == fid) {
-			dir *= get_arrow_size();
-			triangle_vtx.push_back(vec2(c.x, c.y) + dir);
-			triangle_vtx.push_back(vec2(c.x, c.y) + vec2(dir.y, -dir.x));
-			triangle_vtx.push_back(vec2(c.x, c.y) + vec2(-dir.y, dir.x));
-		}
+	// Dormand-Prince 5(4) with step size control. Besides the embedded error estimate the step is
+	// limited by the sagitta of the chord, so curved parts of the branch still get enough vertices.
+	// Coarser levels of detail loosen the tolerance to what their chords could show.
+	template <class Metric>
+	bool march_dopri(std::vector<vec2>& out, bool plus, float sign, vec2& c, vec2& dir) {
+		float len = get_len();
+		float tol = ((segments < fid) ? fmax(tolerance, 1.0f / (segments * segments)) : tolerance) * len;
+		float h_min = len / (16 * segments);
+		float h = len;
+		float s = 0;
 
 		c = p;
-		for (i = 0; i < fid; i++) {
-			if (c.x < 0) break;
-			vtx[3].push_back(vec2(c.x, c.y));
-			dir = ((ddt(M, c.x) < 1) ? 1.0f : 1.0f) * normalize(vec2(-1.0f, ddt(M, c.x)));
-			c = c - (dir * get_len() / fid);
+		if (c.x < 0) return false;
+		out.push_back(c);
+		vec2 k1 = sign * direction<Metric>(c.x, plus);
+		dir = k1;
+		for (int steps = 0; s < len && steps < 16 * segments; steps++) {
+			h = fmin(h, len - s);
+			vec2 k2 = sign * direction<Metric>(c.x + h * (k1.x / 5), plus);
+			vec2 k3 = sign * direction<Metric>(c.x + h * (k1.x * 3 / 40 + k2.x * 9 / 40), plus);
+			vec2 k4 = sign * direction<Metric>(c.x + h * (k1.x * 44 / 45 - k2.x * 56 / 15 + k3.x * 32 / 9), plus);
+			vec2 k5 = sign * direction<Metric>(c.x + h * (k1.x * 19372 / 6561 - k2.x * 25360 / 2187 +
+												  k3.x * 64448 / 6561 - k4.x * 212 / 729),
+									   plus);
+			vec2 k6 = sign * direction<Metric>(c.x + h * (k1.x * 9017 / 3168 - k2.x * 355 / 33 + k3.x * 46732 / 5247 +
+												  k4.x * 49 / 176 - k5.x * 5103 / 18656),
+									   plus);
+			vec2 y = c + h * (k1 * (35.0f / 384) + k3 * (500.0f / 1113) + k4 * (125.0f / 192) -
+							  k5 * (2187.0f / 6784) + k6 * (11.0f / 84));
+			vec2 k7 = sign * direction<Metric>(y.x, plus);
+			vec2 e = k1 * (71.0f / 57600) - k3 * (71.0f / 16695) + k4 * (71.0f / 1920) -
+					 k5 * (17253.0f / 339200) + k6 * (22.0f / 525) - k7 * (1.0f / 40);
+			float err = fmax(h * glm::length(e), h * glm::length(k7 - k1) / 8);
+
+			if (y.x < 0 && (err <= tol || h <= h_min)) {
+				// into the singularity: shorter steps up to it, then the last one cut at r = 0
+				if (h > h_min) {
+					h = fmax(h * c.x / (c.x - y.x), h_min);
+					continue;
+				}
+				c += (y - c) * (c.x / (c.x - y.x));
+				c.x = 0;
+				out.push_back(c);
+				dir = k7;
+				return false;
+			}
+			if (err <= tol || h <= h_min) {
+				s += h;
+				c = y;
+				out.push_back(c);
+				k1 = k7;
+				dir = k7;
+			}
+			h *= (err > 0) ? fmin(fmax(0.9f * pow(tol / err, 0.2f), 0.2f), 5.0f) : 5.0f;
+			h = fmax(h, h_min);
 		}
+		return s >= len;
 	}
 
-	float dt(float M, float r, float ra) {
-		return r - ra + 2 * M * log(abs((r / M - 2) / (ra / M - 2)));
+	// Closed form branch: along the plus (minus) null curve t - p.y = +dt (-dt), so each vertex depends
+	// only on its own r. The branch ends where the chord from the apex reaches get_len(), found once
+	// by bisection. Vertices are spread uniformly in w = ln|r - 2M|, which keeps the t steps even
+	// where the logarithm dominates near the horizon.
+	// In Eddington-Finkelstein time the plus curve has twice the logarithm and the minus curve none:
+	// it is a line, and so is the plus curve of an apex on the horizon.
+	bool sample_tortoise(std::vector<vec2>& out, bool plus, float sign, vec2& c, vec2& dir) {
+		TortoiseBranch& b = tortoise[(plus ? 0 : 2) + (sign > 0 ? 0 : 1)];
+		size_t first = out.size();
+		out.resize(first + b.segments + 1);
+		sample(b, p, M, &out[first]);
+		c = b.end;
+		dir = b.dir;
+		return b.complete;
 	}
 
-	float ddt(float M, float r) {
-		return r / (r - 2 * M);
+	// the b.segments + 1 vertices of the branch b of the cone at apex
+	static void sample(const TortoiseBranch& b, vec2 apex, float M, vec2* out) {
+		const int n = b.segments + 1;
+		if (b.straight) {
+			for (int i = 0; i < n; i++) {
+				out[i] = apex + (float)i * b.step;
+			}
+		} else {
+			tortoise_kernel(out, n, apex.x, apex.y, M, b.w0, b.dw, b.side, b.kappa, b.c);
+		}
 	}
 
-	using Object::draw;
-	void draw(GPUProgram* gpuProgram, Camera& camera) {
-		// update();
-		glLineWidth(3);
-		for (int i = 0; i < vtx.size(); i++) {
-			draw(gpuProgram, GL_LINE_STRIP, camera, vtx[i]);
+	// fills b[k] for the branch vtx[k]
+	void tortoise_branches(TortoiseBranch b[4]) {
+		float len = get_len();
+		bool ef = coords == EDDINGTON_FINKELSTEIN;
+		float side = (p.x > 2 * M) ? 1.0f : -1.0f;
+		float sr[4], r_lim[4], r_end[4];
+		for (int k = 0; k < 4; k++) {
+			bool plus = k < 2;
+			float sign = (k % 2 == 0) ? 1.0f : -1.0f;
+			b[k].side = side;
+			b[k].kappa = plus ? 1.0f : -1.0f;
+			b[k].segments = segments;
+			b[k].c = ef ? (plus ? 2.0f : 0.0f) : b[k].kappa;
+			b[k].straight = ef && (!plus || floatCmp(2 * M, p.x));
+			sr[k] = plus ? sign * side : -sign;	 // direction of r along the branch
+			r_lim[k] = p.x;
+
+			if (b[k].straight) {
+				vec2 dir = sign * direction<Schwarzschild>(p.x, plus);
+				float l = (dir.x < 0) ? fmin(len, p.x / -dir.x) : len;	// up to the singularity
+				b[k].complete = l == len;
+				b[k].step = dir * (l / segments);
+				b[k].end = p + dir * l;
+				b[k].dir = dir;
+				continue;
+			}
+			r_lim[k] = p.x + sr[k] * len;
+			if (sr[k] < 0) r_lim[k] = fmax(r_lim[k], 0.0f);
+			if (side > 0 && sr[k] < 0) r_lim[k] = fmax(r_lim[k], 2 * M);
+			if (side < 0 && sr[k] > 0) r_lim[k] = fmin(r_lim[k], 2 * M);
+			b[k].complete = chord(r_lim[k], b[k].c * b[k].kappa) >= len;
+		}
+		chord_bisect4(p.x, M, len, ef ? 2.0f : 1.0f, r_lim, r_end);
+
+		float w0 = log(fabs(p.x - 2 * M));
+		for (int k = 0; k < 4; k++) {
+			if (b[k].straight) continue;
+			if (!b[k].complete) r_end[k] = r_lim[k];
+			b[k].w0 = w0;
+			b[k].dw = (log(fabs(r_end[k] - 2 * M)) - w0) / segments;
+			float r1 = 2 * M + side * exp(w0 + segments * b[k].dw);
+			b[k].end = vec2(r1, p.y + b[k].kappa * (r1 - p.x) + b[k].c * 2 * M * (segments * b[k].dw));
+			float slope = b[k].kappa + b[k].c * 2 * M / (r_end[k] - 2 * M);	 // dt/dr along the branch
+			b[k].dir = normalize(vec2(sr[k], sr[k] * slope));
 		}
-		draw(gpuProgram, GL_TRIANGLES, camera, triangle_vtx);
 	}
 
-private:
+	// length of the chord from the apex to the point at r of the curve t = r - p.x + c 2M (w - w0)
+	float chord(float r, float c) {
+		return glm::length(vec2(r - p.x, r - p.x + c * 2 * M * log(fabs((r - 2 * M) / (p.x - 2 * M)))));
+	}
+
+   private:
 	void clear() {
 		for (auto& varr : vtx) {
 		 	varr.clear();
@@ -237,15 +1051,655 @@ private:
 		triangle_vtx.clear();
 	}
 
+	float get_len() {
+		return len;
+	}
+
+	float get_arrow_size() {
+		return get_len()*0.2f;
+	}
+};
+
+class Cone {
+	vec2 p;
+	float M;
+
+	float length = 0.5f;
+	ConeGeometry geom;
+	VertexArray<vec2> strips, triangles;  // geom on the GPU, the branches one after the other
+	std::vector<size_t> strip_first;
+	Camera* cam;
+	bool relative = false;
+	INTEGRATOR integrator = EULER;
+	float tolerance = 1e-3f;
+	COORDINATES coords = SCHWARZSCHILD;
+	Spacetime spacetime;
+	int segments = ConeGeometry::fid;
+
+   public:
+	Cone(float M, vec2 p, Camera& cam, bool relative = false, INTEGRATOR integrator = EULER,
+		 float tolerance = 1e-3f, COORDINATES coords = SCHWARZSCHILD, Spacetime spacetime = Spacetime())
+		: p(p), M(M), cam(&cam), relative(relative), integrator(integrator), tolerance(tolerance), coords(coords),
+		  spacetime(spacetime) {
+		update(relative, integrator, tolerance, coords, spacetime);
+	}
+
+	void update(bool relative, INTEGRATOR integrator = EULER, float tolerance = 1e-3f,
+				COORDINATES coords = SCHWARZSCHILD, Spacetime spacetime = Spacetime()) {
+		this->relative = relative;
+		this->integrator = integrator;
+		this->tolerance = tolerance;
+		this->coords = coords;
+		this->spacetime = spacetime;
+		segments = lod();
+		geom.generate(M, p, get_len(), integrator, tolerance, coords, spacetime, segments);
+
+		std::vector<vec2>& v = strips.edit();
+		v.clear();
+		strip_first.clear();
+		for (const std::vector<vec2>& branch : geom.vtx) {
+			strip_first.push_back(v.size());
+			v.insert(v.end(), branch.begin(), branch.end());
+		}
+		strip_first.push_back(v.size());
+		triangles.edit() = geom.triangle_vtx;
+	}
+
+	// segments per branch at the current zoom
+	int lod() {
+		return ConeGeometry::lod(get_len() * cam->pixels_per_unit(), integrator);
+	}
+
+	bool lod_changed() {
+		return lod() != segments;
+	}
+
+	// takes effect on the next update
+	void move(float M, vec2 p) {
+		this->M = M;
+		this->p = p;
+	}
+
+	// first: where each branch starts in strips, one past the last at the end
+	void snapshot(Part<vec2>& strips, std::vector<size_t>& first, Part<vec2>& triangles) const {
+		if (strips.take(this->strips)) first = strip_first;
+		triangles.take(this->triangles);
+	}
+
+private:
 	float get_len() {
 		if (relative) {
 			return length*cam->get_size()*0.1f;
 		}
 		return length;
 	}
+};
 
-	float get_arrow_size() {
-		return get_len()*0.2f;
+// Cone shapes with the apex at t = 0. The metric is static, so the cone at (r, t) is the shape for r
+// shifted by t, and every cone at the same r shares one shape. r is quantised in w = ln|r - 2M| with
+// a step proportional to the branch length: fine near the horizon, where the shape changes quickly,
+// and coarse far away from it.
+class ConeShapeCache {
+   public:
+	struct Shape {
+		float r;  // apex of the shape, the quantised r
+		GLint lines_first;
+		GLsizei lines_count;
+		GLint triangle_first;
+		GLsizei triangle_count;
+	};
+
+	// every shape, each as its four branches unrolled to GL_LINES followed by its arrowheads, so that a
+	// shape is two instanced draws
+	std::vector<vec2> vtx;
+	std::vector<Shape> shapes;
+	unsigned long long revision = 0;  // of vtx and shapes
+
+	struct Key {
+		float anchor;  // the horizon closest to the apex, 0 if there is none
+		int side;	   // side of the anchor, 0 on it
+		long long w;
+		float M, len;
+		int segments;  // level of detail
+		bool operator==(const Key& k) const {
+			return anchor == k.anchor && side == k.side && w == k.w && M == k.M && len == k.len &&
+				   segments == k.segments;
+		}
+	};
+
+   private:
+	struct KeyHash {
+		size_t operator()(const Key& k) const {
+			size_t h = std::hash<long long>()(k.w * 3 + k.side);
+			h ^= std::hash<float>()(k.anchor) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			h ^= std::hash<float>()(k.M) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			h ^= std::hash<float>()(k.len) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			h ^= std::hash<int>()(k.segments) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+	// a shape reserved by find(), generated by generate_pending()
+	struct Pending {
+		int shape;
+		float M, len;
+		int segments;
+		std::vector<vec2> lines, triangles;
+	};
+
+	std::unordered_map<Key, int, KeyHash> index;
+	std::vector<Pending> pending;
+	float scale = 1;
+	bool relative = false;
+	INTEGRATOR integrator = EULER;
+	float tolerance = 1e-3f;
+	COORDINATES coords = SCHWARZSCHILD;
+	Spacetime spacetime;
+	float pixels_per_unit = 60;
+
+   public:
+	// drops every shape if the parameters they were generated with changed, returns whether it did
+	bool configure(float scale, bool relative, INTEGRATOR integrator, float tolerance, COORDINATES coords,
+				   Spacetime spacetime) {
+		if (scale == this->scale && relative == this->relative && integrator == this->integrator &&
+			tolerance == this->tolerance && coords == this->coords && spacetime == this->spacetime) {
+			return false;
+		}
+		this->scale = scale;
+		this->relative = relative;
+		this->integrator = integrator;
+		this->tolerance = tolerance;
+		this->coords = coords;
+		this->spacetime = spacetime;
+		clear();
+		return true;
+	}
+
+	void clear() {
+		vtx.clear();
+		shapes.clear();
+		index.clear();
+		pending.clear();
+		revision++;
+	}
+
+	// the zoom the levels of detail of new keys are chosen for; shapes of other levels stay
+	void set_pixels_per_unit(float pixels_per_unit) {
+		this->pixels_per_unit = pixels_per_unit;
+	}
+
+	// the quantised apex of the cone at r, in steps relative to its distance from the closest horizon;
+	// touches nothing, so it may run on any thread
+	Key key(float M, float r, float len) const {
+		len *= scale;
+		Key key = {0, 0, 0, M, len, ConeGeometry::lod(len * pixels_per_unit, integrator)};
+		float roots[3];
+		for (int i = 0, n = horizons(spacetime, M, roots); i < n; i++) {
+			if (i == 0 || fabs(r - roots[i]) < fabs(r - key.anchor)) key.anchor = roots[i];
+		}
+		if (!floatCmp(key.anchor, r)) {
+			key.side = (r > key.anchor) ? 1 : -1;
+			key.w = llround(log(fabs(r - key.anchor)) / quantum(key));
+		}
+		return key;
+	}
+
+	// index of the shape of the key; a new shape is only reserved, its vertices come from generate_pending()
+	int find(const Key& key) {
+		auto it = index.find(key);
+		if (it != index.end()) return it->second;
+
+		int k = (int)shapes.size();
+		index[key] = k;
+		Shape shape = {};
+		shape.r = key.anchor + key.side * exp(key.w * quantum(key));
+		shapes.push_back(shape);
+		pending.push_back(Pending{k, key.M, key.len, key.segments, {}, {}});
+		return k;
+	}
+
+	// generates the reserved shapes on the thread pool, each into its own buffers, then copies them to
+	// their ranges of vtx, which are disjoint as well
+	void generate_pending() {
+		if (pending.empty()) return;
+		ThreadPool& pool = threadPool();
+		pool.parallel_for(pending.size(), 8, [this](size_t begin, size_t end) {
+			ConeGeometry scratch;
+			std::vector<vec2> strip;
+			for (size_t i = begin; i < end; i++) {
+				generate(pending[i], scratch, strip);
+			}
+		});
+
+		size_t first = vtx.size();
+		for (Pending& p : pending) {
+			Shape& shape = shapes[p.shape];
+			shape.lines_first = (GLint)first;
+			shape.lines_count = (GLsizei)p.lines.size();
+			shape.triangle_first = (GLint)(first + p.lines.size());
+			shape.triangle_count = (GLsizei)p.triangles.size();
+			first += p.lines.size() + p.triangles.size();
+		}
+		vtx.resize(first);
+		pool.parallel_for(pending.size(), 64, [this](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				Pending& p = pending[i];
+				Shape& shape = shapes[p.shape];
+				std::copy(p.lines.begin(), p.lines.end(), vtx.begin() + shape.lines_first);
+				std::copy(p.triangles.begin(), p.triangles.end(), vtx.begin() + shape.triangle_first);
+			}
+		});
+		pending.clear();
+		revision++;
+	}
+
+   private:
+	static float quantum(const Key& key) {
+		return key.len / ((key.anchor > 0) ? 1024 * key.anchor : 1024);
+	}
+
+	void generate(Pending& p, ConeGeometry& scratch, std::vector<vec2>& strip) const {
+		float r = shapes[p.shape].r;
+		scratch.place(p.M, vec2(r, 0), p.len, integrator, tolerance, coords, spacetime, p.segments);
+		if (!scratch.is_closed_form() || scratch.is_horizon()) {
+			scratch.generate();
+			for (auto& branch : scratch.vtx) {
+				add_lines(p.lines, branch);
+			}
+		} else {
+			ConeGeometry::TortoiseBranch b[4];
+			scratch.tortoise_branches(b);
+			strip.resize(p.segments + 1);
+			for (int k = 0; k < 4; k++) {
+				ConeGeometry::sample(b[k], vec2(r, 0), p.M, strip.data());
+				add_lines(p.lines, strip);
+				if (b[k].complete && k % 2 == 0) scratch.add_arrow(b[k].end, b[k].dir);
+			}
+		}
+		p.triangles = scratch.triangle_vtx;
+	}
+
+	static void add_lines(std::vector<vec2>& lines, const std::vector<vec2>& strip) {
+		for (size_t i = 1; i < strip.size(); i++) {
+			lines.push_back(strip[i - 1]);
+			lines.push_back(strip[i]);
+		}
+	}
+};
+
+// Uniform grid over points, hashed so that it covers any extent sparsely. Cones are indexed by their apex:
+// one reaches at most its branch length and arrowhead from it, so a query widened by the longest reach
+// finds every cone that may be visible.
+// Each point is in every level of the grid, the cells of a level ratio times as wide as the one below. A
+// rectangle is looked up on the finest level where it spans at most max_cells cells, so neither a
+// zoomed out view walks the cells of the whole scene nor a close one gathers much beyond the view.
+class SpatialGrid {
+	static const int levels = 5, ratio = 16, max_cells = 4096;
+	float cell;	 // of level 0
+	std::unordered_map<long long, std::vector<int>> cells[levels];
+
+	static long long key(int x, int y) {
+		return (long long)((unsigned long long)(unsigned int)x << 32 | (unsigned int)y);
+	}
+	// floor(v), clamped so that far-out points share the outermost cells instead of overflowing the int
+	static int index(float v) {
+		return (int)fmin(fmax(floor(v), -1e9f), 1e9f);
+	}
+	float size(int level) {
+		return cell * powf((float)ratio, (float)level);
+	}
+
+   public:
+	// the cells of one level overlapping a rectangle
+	struct Range {
+		int level, x0, y0, x1, y1;
+		bool operator==(const Range& r) const {
+			return level == r.level && x0 == r.x0 && y0 == r.y0 && x1 == r.x1 && y1 == r.y1;
+		}
+		bool operator!=(const Range& r) const {
+			return !(*this == r);
+		}
+		long long area() const {
+			return (long long)(x1 - x0 + 1) * (y1 - y0 + 1);
+		}
+	};
+
+	SpatialGrid(float cell = 1) : cell(cell) {}
+
+	void insert(int i, vec2 p) {
+		for (int k = 0; k < levels; k++) {
+			float s = size(k);
+			cells[k][key(index(p.x / s), index(p.y / s))].push_back(i);
+		}
+	}
+
+	void clear() {
+		for (auto& level : cells) level.clear();
+	}
+
+	Range range(vec2 lo, vec2 hi) {
+		Range r;
+		for (int k = 0; k < levels; k++) {
+			float s = size(k);
+			r = Range{k, index(lo.x / s), index(lo.y / s), index(hi.x / s), index(hi.y / s)};
+			if (r.area() <= max_cells) break;
+		}
+		return r;
+	}
+
+	// appends the points in the cells of r; walks the occupied cells instead when there are fewer of them
+	void query(const Range& r, std::vector<int>& out) {
+		auto& level = cells[r.level];
+		if (r.area() > (long long)level.size()) {
+			for (auto& c : level) {
+				int x = (int)(unsigned int)(c.first >> 32), y = (int)(unsigned int)c.first;
+				if (x >= r.x0 && x <= r.x1 && y >= r.y0 && y <= r.y1) {
+					out.insert(out.end(), c.second.begin(), c.second.end());
+				}
+			}
+			return;
+		}
+		for (int x = r.x0; x <= r.x1; x++) {
+			for (int y = r.y0; y <= r.y1; y++) {
+				auto it = level.find(key(x, y));
+				if (it != level.end()) out.insert(out.end(), it->second.begin(), it->second.end());
+			}
+		}
+	}
+};
+
+// What ConeBatch draws: a ConeField as it was at the end of an update
+struct ConeSnapshot {
+	Part<vec2> vtx;	 // of every shape
+	std::vector<ConeShapeCache::Shape> shapes;
+	Part<vec2> offsets;
+	std::vector<int> shape_first;
+	Part<float> attributes;	 // of the procedural cones
+	bool procedural = false;
+	float scale = 1;
+	int segments = ConeGeometry::fid;
+	bool ef = false;
+};
+
+// All cones placed in the scene in structure-of-arrays form. Only the distinct shapes are generated
+// (see ConeShapeCache); they share one vertex array, and the apex offsets of the cones are sorted by
+// shape, so ConeBatch draws each shape once for all of its cones.
+// In SHADER mode nothing is generated on the CPU: the arrays themselves are the instance data of
+// cone_vert_source.
+// Only the cones a SpatialGrid query finds around the view get a shape and an instance.
+// Everything here is CPU work, done on the simulation thread; snapshot() hands the result over.
+class ConeField {
+	std::vector<float> r0, t0, mass, length;
+	std::vector<int> shape;
+	ConeShapeCache cache;
+
+	std::vector<vec2> offsets;		 // apex offsets of the visible cones, grouped by shape
+	std::vector<int> shape_first;	 // first offset of each shape, one past the last at the end
+	unsigned long long offsets_revision = 0;
+
+	SpatialGrid grid;
+	SpatialGrid::Range view = {0, 0, 0, -1, -1};
+	std::vector<int> visible;
+	float longest = 0;			// branch length
+	bool index_changed = true;	// cones were added or moved since the last query
+
+	// shape[i] < 0 marks a cone to look up when it is visible; stale marks all of them
+	std::vector<int> missing;
+	std::vector<ConeShapeCache::Key> keys;	// of the missing cones
+	bool stale = false;
+
+	bool procedural = false;
+	std::vector<float> attributes;	// r0, t0, mass and length of the visible cones, one array after the other
+	unsigned long long attributes_revision = 0;
+	bool attributes_stale = true;
+	float scale = 1;
+	COORDINATES coords = SCHWARZSCHILD;
+	Spacetime spacetime;
+	float pixels_per_unit = 0;	// the zoom, rounded to a power of two
+	int procedural_segments = ConeGeometry::fid;
+
+   public:
+	void add(float M, vec2 p, float len = 0.5f) {
+		r0.push_back(p.x);
+		t0.push_back(p.y);
+		mass.push_back(M);
+		length.push_back(len);
+		shape.push_back(-1);
+		grid.insert((int)size() - 1, p);
+		longest = fmax(longest, len);
+		index_changed = true;
+	}
+
+	void set_mass(float M) {
+		std::fill(mass.begin(), mass.end(), M);
+		cache.clear();
+		stale = true;
+		attributes_stale = true;
+	}
+
+	size_t size() {
+		return r0.size();
+	}
+
+	void clear() {
+		r0.clear();
+		t0.clear();
+		mass.clear();
+		length.clear();
+		shape.clear();
+		offsets.clear();
+		shape_first.clear();
+		offsets_revision++;
+		cache.clear();
+		grid.clear();
+		visible.clear();
+		longest = 0;
+		index_changed = true;
+		stale = false;
+		attributes_stale = true;
+	}
+
+	// moves every apex of spacetime to the time coordinate to, from the other one; apexes on a
+	// horizon, where Schwarzschild time is undefined, keep their t
+	void convert(COORDINATES to, const Spacetime& spacetime) {
+		float s = (to == EDDINGTON_FINKELSTEIN) ? 1.0f : -1.0f;
+		for (size_t i = 0; i < size(); i++) {
+			float shift = tortoise_shift(spacetime, r0[i], mass[i]);
+			if (std::isfinite(shift)) t0[i] += s * shift;
+		}
+		grid.clear();
+		for (size_t i = 0; i < size(); i++) {
+			grid.insert((int)i, vec2(r0[i], t0[i]));
+		}
+		index_changed = true;
+	}
+
+	// scale multiplies every branch length, e.g. to follow the zoom in relative mode. The levels of detail
+	// are chosen for pixels_per_unit rounded to a power of two, so the shapes are only looked up again
+	// when the zoom crosses one. lo and hi are the corners of the view.
+	void update(float scale, bool relative, INTEGRATOR integrator, float tolerance, COORDINATES coords,
+				Spacetime spacetime, float pixels_per_unit, vec2 lo, vec2 hi) {
+		this->scale = scale;
+		this->coords = coords;
+		this->spacetime = spacetime;
+		procedural = (integrator == SHADER && spacetime.metric == SCHWARZSCHILD_METRIC);  // see cone_vert_source
+		float zoom = exp2(round(log2(pixels_per_unit)));
+
+		float reach = 1.2f * longest * scale;  // branch and arrowhead
+		SpatialGrid::Range range = grid.range(lo - vec2(reach), hi + vec2(reach));
+		bool view_changed = range != view || index_changed;
+		if (view_changed) {
+			view = range;
+			index_changed = false;
+			visible.clear();
+			grid.query(range, visible);
+			attributes_stale = true;
+		}
+		if (procedural) {
+			procedural_segments = ConeGeometry::lod(longest * scale * zoom, SHADER);
+			if (attributes_stale) gather();
+			return;
+		}
+
+		if (cache.configure(scale, relative, integrator, tolerance, coords, spacetime)) stale = true;
+		if (zoom != this->pixels_per_unit) {
+			this->pixels_per_unit = zoom;
+			cache.set_pixels_per_unit(zoom);
+			stale = true;
+		}
+		if (stale) {
+			std::fill(shape.begin(), shape.end(), -1);
+			stale = false;
+		} else if (!view_changed) {
+			return;
+		}
+
+		// keys in parallel, the map serially, then the new shapes in parallel again
+		missing.clear();
+		for (int i : visible) {
+			if (shape[i] < 0) missing.push_back(i);
+		}
+		keys.resize(missing.size());
+		threadPool().parallel_for(missing.size(), 1024, [this](size_t begin, size_t end) {
+			for (size_t j = begin; j < end; j++) {
+				int i = missing[j];
+				keys[j] = cache.key(mass[i], r0[i], length[i]);
+			}
+		});
+		for (size_t j = 0; j < missing.size(); j++) {
+			shape[missing[j]] = cache.find(keys[j]);
+		}
+		cache.generate_pending();
+
+		// counting sort of the visible cones by shape
+		shape_first.assign(cache.shapes.size() + 1, 0);
+		for (int i : visible) {
+			shape_first[shape[i] + 1]++;
+		}
+		for (size_t k = 1; k < shape_first.size(); k++) {
+			shape_first[k] += shape_first[k - 1];
+		}
+		std::vector<int> next(shape_first.begin(), shape_first.end() - 1);
+		offsets.resize(visible.size());
+		for (int i : visible) {
+			offsets[next[shape[i]]++] = vec2(r0[i] - cache.shapes[shape[i]].r, t0[i]);
+		}
+		offsets_revision++;
+	}
+
+	// copies what changed since s was last written into it
+	void snapshot(ConeSnapshot& s) {
+		if (s.vtx.take(cache.vtx, cache.revision)) s.shapes = cache.shapes;
+		if (s.offsets.take(offsets, offsets_revision)) s.shape_first = shape_first;
+		s.attributes.take(attributes, attributes_revision);
+		s.procedural = procedural;
+		s.scale = scale;
+		s.segments = procedural_segments;
+		s.ef = (coords == EDDINGTON_FINKELSTEIN);
+	}
+
+   private:
+	void gather() {
+		size_t n = visible.size();
+		std::vector<float>* arrays[] = {&r0, &t0, &mass, &length};
+		attributes.resize(4 * n);
+		for (int i = 0; i < 4; i++) {
+			for (size_t j = 0; j < n; j++) {
+				attributes[i * n + j] = (*arrays[i])[visible[j]];
+			}
+		}
+		attributes_revision++;
+		attributes_stale = false;
+	}
+};
+
+// The GL side of the cones: the shapes in one vertex buffer, the offsets as instance data, or the
+// gathered arrays as the instance data of cone_vert_source. The shapes are uploaded when the snapshot
+// carries newer ones; the instance data is streamed through streamBuffer() the same way.
+class ConeBatch : public Object<vec2> {
+	unsigned int procedural_vao;
+	unsigned long long vtx_uploaded = 0;  // revision
+	StreamBuffer::Allocation offsets, attributes;
+	struct ConeUniforms {
+		GPUProgram* prog = nullptr;
+		Uniform<float> scale;
+		Uniform<int> fid, ef, arrows;
+	} cone_uniforms;
+
+   public:
+	ConeBatch() {
+		color = vec4(1.0f, 1.0f, 0.0f, 1.0f);
+		glBindVertexArray(vao);
+		glEnableVertexAttribArray(1);
+		glVertexAttribDivisor(1, 1);
+
+		glGenVertexArrays(1, &procedural_vao);
+		glBindVertexArray(procedural_vao);
+		for (int i = 1; i <= 4; i++) {
+			glEnableVertexAttribArray(i);
+			glVertexAttribDivisor(i, 1);
+		}
+	}
+
+	void draw(GPUProgram* gpuProgram, GPUProgram* coneProgram, Camera& camera, const ConeSnapshot& s) {
+		if (s.procedural) {
+			draw_procedural(coneProgram, camera, s);
+			return;
+		}
+		if (s.offsets.data.empty()) return;
+		if (s.vtx.revision != vtx_uploaded) {
+			updateGPU(s.vtx.data);
+			vtx_uploaded = s.vtx.revision;
+		}
+		size_t offset = streamBuffer().update(offsets, s.offsets.data.data(), s.offsets.data.size() * sizeof(vec2),
+											  s.offsets.revision);
+
+		setUniforms(gpuProgram, camera, color);
+		glLineWidth(3);
+		glBindVertexArray(vao);
+		for (size_t k = 0; k < s.shapes.size(); k++) {
+			GLsizei n = s.shape_first[k + 1] - s.shape_first[k];
+			if (n == 0) continue;
+			const ConeShapeCache::Shape& shape = s.shapes[k];
+			glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)(offset + s.shape_first[k] * sizeof(vec2)));
+			glDrawArraysInstanced(GL_LINES, shape.lines_first, shape.lines_count, n);
+			if (shape.triangle_count > 0) {
+				glDrawArraysInstanced(GL_TRIANGLES, shape.triangle_first, shape.triangle_count, n);
+			}
+		}
+	}
+
+	void draw_procedural(GPUProgram* coneProgram, Camera& camera, const ConeSnapshot& s) {
+		GLsizei n = (GLsizei)(s.attributes.data.size() / 4);
+		if (n == 0) return;
+		glBindVertexArray(procedural_vao);
+		size_t bytes = n * sizeof(float);
+		size_t offset = streamBuffer().update(attributes, s.attributes.data.data(), 4 * bytes, s.attributes.revision);
+		for (int i = 0; i < 4; i++) {
+			glVertexAttribPointer(i + 1, 1, GL_FLOAT, GL_FALSE, 0, (void*)(offset + i * bytes));
+		}
+
+		const int fid = s.segments;
+		setUniforms(coneProgram, camera, color);
+		ConeUniforms& u = cone_uniforms;
+		if (u.prog != coneProgram) {
+			u.prog = coneProgram;
+			u.scale = coneProgram->uniform<float>("scale");
+			u.fid = coneProgram->uniform<int>("fid");
+			u.ef = coneProgram->uniform<int>("ef");
+			u.arrows = coneProgram->uniform<int>("arrows");
+		}
+		u.scale.set(s.scale);
+		u.fid.set(fid);
+		u.ef.set(s.ef);
+		glLineWidth(3);
+		u.arrows.set(0);
+		glDrawArraysInstanced(GL_LINES, 0, 4 * 2 * fid, n);
+		u.arrows.set(1);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 6, n);
+	}
+
+	~ConeBatch() {
+		glDeleteVertexArrays(1, &procedural_vao);
 	}
 };
 
@@ -264,107 +1718,103 @@ void swap(T& a, T& b) {
 	b = temp;
 }
 
-class Grid : Object<vec2> {
-	std::vector<vec2> vtx_whole;
-	std::vector<vec2> vtx_fractional;
+// See grid_vert_source. The quad has no vertex data, only an empty vertex array object to draw it with.
+class Grid {
+	unsigned int vao;
+	GPUProgram* prog = nullptr;
+	Uniform<vec4> color;
+	Uniform<float> min_spacing;
 
    public:
 	Grid() {
-		color = vec4(0.5f, 0.5f, 0.5f, 1.0f);
+		glGenVertexArrays(1, &vao);
 	}
-	void update(Camera& camera) {
-		vtx_whole.clear();
-		vtx_fractional.clear();
 
-		vec2 a = camera.convert(0, 0);
-		vec2 b = camera.convert(winWidth, winHeight);
-		int x1 = a.x < 0 ? 0 : a.x;
-		int x2 = b.x < 0 ? 0 : b.x;
-		int y1 = a.y;
-		int y2 = b.y;
-		if (x1 > x2) swap(x1, x2);
-		if (y1 > y2) swap(y1, y2);
-
-		for (int i = x1; i <= x2 + 1; i++) {
-			vtx_whole.push_back(vec2(i, a.y));
-			vtx_whole.push_back(vec2(i, b.y));
-		}
-		for (float i = x1; i <= x2 + 1; i += 0.5f) {
-			vtx_fractional.push_back(vec2(i, a.y));
-			vtx_fractional.push_back(vec2(i, b.y));
-		}
-		/* t-coordinates
-		for (int i = y1; i <= y2 + 1; i++) {
-			vtx.push_back(vec2(x1, i));
-			vtx.push_back(vec2(x2 + 1, i));
-		}*/
-	}
-
-	using Object::draw;
-	void draw(GPUProgram* gpuProgram, Camera& camera) {
-		update(camera);
-		glLineWidth(1);
-		draw(gpuProgram, GL_LINES, camera, vtx_fractional, vec4(0.1f, 0.1f, 0.1f, 0.0f));
-		glLineWidth(1);
-		draw(gpuProgram, GL_LINES, camera, vtx_whole, vec4(0.5f, 0.5f, 0.5f, 1.0f));
+	void draw(GPUProgram* gridProgram, Camera& camera) {
+		camera.upload();
+		gridProgram->Use();
+		if (prog != gridProgram) {
+			prog = gridProgram;
+			color = gridProgram->uniform<vec4>("color");
+			min_spacing = gridProgram->uniform<float>("min_spacing");
+		}
+		int width, height;
+		getFramebufferSize(&width, &height);
+		color.set(vec4(0.5f, 0.5f, 0.5f, 1.0f));
+		min_spacing.set(5.0f * width / winWidth);	// the same decades on HiDPI screens
+		glBindVertexArray(vao);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+
+	~Grid() {
+		glDeleteVertexArrays(1, &vao);
 	}
 };
 
-class Singularity : Object<vec2> {
-	std::vector<vec2> vtx;
+class Singularity {
+	VertexArray<vec2> vtx;
 
    public:
-	Singularity() {
-		color = vec4(0.25f, 0.5f, 1.0f, 1.0f);
-	}
 	void update(Camera& camera) {
-		vtx.clear();
 		vec2 a = camera.convert(0, 0);
 		vec2 b = camera.convert(winWidth, winHeight);
+		if (vtx.size() > 0 && vtx.get()[0].y == a.y && vtx.get()[1].y == b.y) return;
 
-		vtx.push_back(vec2(0, a.y));
-		vtx.push_back(vec2(0, b.y));
+		std::vector<vec2>& v = vtx.edit();
+		v.clear();
+		v.push_back(vec2(0, a.y));
+		v.push_back(vec2(0, b.y));
 	}
 
-	using Object::draw;
-	void draw(GPUProgram* gpuProgram, Camera& camera) {
-		glLineWidth(10);
-		draw(gpuProgram, GL_LINES, camera, vtx);
+	void snapshot(Part<vec2>& part) const {
+		part.take(vtx);
 	}
 };
 
-class Horizon : Object<vec2> {
-	std::vector<vec2> vtx;
+class Horizon {
+	VertexArray<vec2> vtx;
 	float top = 0.0f;
 	float bottom = 0.0f;
+	float last_top = 0.0f, last_bottom = 0.0f, last_diff = 0.0f, last_M = 0.0f;
+	Spacetime last_spacetime;
 
    public:
-	Horizon() {
-		color = vec4(0.25f, 1.0f, 0.5f, 1.0f);
-	}
-	void update(Camera& camera, float M) {
-		vtx.clear();
+	void update(Camera& camera, float M, const Spacetime& spacetime) {
 		vec2 bottom_left = camera.convert(0, winHeight);
 		vec2 top_right = camera.convert(winWidth, 0);
 		float diff = 0.1 * camera.get_size();
+		float slack = 1.0f + 0.5f * camera.get_size();	// the view may move on before the dashes are drawn
 
-		while (bottom >= bottom_left.y - 1.0f){
+		while (bottom >= bottom_left.y - slack){
 			bottom -= diff;
 		}
-		while (top <= top_right.y + 1.0f){
+		while (top <= top_right.y + slack){
 			top += diff;
 		}
 
-		for (float i = bottom; i < top; i += diff) {
-		 	vtx.push_back(vec2(2 * M, i));
-		 	vtx.push_back(vec2(2 * M, i + diff / 2.0f));
+		// the dashes only move when the range grows or the zoom, mass or metric change
+		if (top == last_top && bottom == last_bottom && diff == last_diff && M == last_M &&
+			spacetime == last_spacetime && vtx.size() > 0)
+			return;
+		last_top = top;
+		last_bottom = bottom;
+		last_diff = diff;
+		last_M = M;
+		last_spacetime = spacetime;
+
+		std::vector<vec2>& v = vtx.edit();
+		v.clear();
+		float r[3];
+		for (int k = 0, n = horizons(spacetime, M, r); k < n; k++) {
+			for (float i = bottom; i < top; i += diff) {
+				v.push_back(vec2(r[k], i));
+				v.push_back(vec2(r[k], i + diff / 2.0f));
+			}
 		}
 	}
 
-	using Object::draw;
-	void draw(GPUProgram* gpuProgram, Camera& camera) {
-		glLineWidth(2);
-		draw(gpuProgram, GL_LINES, camera, vtx);
+	void snapshot(Part<vec2>& part) const {
+		part.take(vtx);
 	}
 };
 
@@ -373,98 +1823,383 @@ enum MODE {
 	FOLLOW
 };
 
-class Scene {
-	std::vector<Cone> cones;
-	GPUProgram* gpuProgram;
-	Camera* camera;
-	Grid grid;
+// One frame of the simulation: everything Scene draws
+struct SceneSnapshot {
+	Part<vec2> singularity, horizon;
+	Part<vec2> cursor_strips, cursor_triangles;
+	std::vector<size_t> cursor_first;  // of the branches in cursor_strips, one past the last at the end
+	bool follow = false;			   // the cursor cone is shown
+	ConeSnapshot cones;
+};
+
+// what the render thread shows, sent to the simulation when it changes
+struct View {
+	Camera camera = Camera(vec2(0, 0), vec2(1, 1));
+	MODE mode = PUT;
+};
+
+// Owns the scene and generates its geometry on a thread of its own, so that onDisplay only uploads and
+// draws. The public methods post a change and return at once; the thread applies the changes in order,
+// rebuilds what they and the latest view invalidated, and publishes a SceneSnapshot through a
+// TripleBuffer. Neither side waits for the other: the render thread draws the newest complete snapshot,
+// and the simulation never blocks on a frame. The grid is not here: it needs no geometry, see Grid.
+// Geometry is rebuilt only when its inputs change: ConeField tracks added cones and the parameters of
+// its shapes, the cursor cone is rebuilt when it moves or one of its parameters (including the zoom in
+// relative mode) changes.
+class Simulation {
+	ConeField cones;
+	Camera camera;	// of the latest view
+	MODE mode = PUT;
 	Singularity singularity;
 	Horizon hor;
 	float M = 1;
 	vec2 mouse_pos;
 	bool is_cone_size_dynamic = false;
+	INTEGRATOR integrator = EULER;
+	float tolerance = 1e-3f;
+	COORDINATES coords = SCHWARZSCHILD;
+	METRIC metric = SCHWARZSCHILD_METRIC;
+	float charge = 0.8f;	// of Reissner-Nordstrom, in units of M
+	float lambda = 0.01f;	// cosmological constant of de Sitter
+
+	Cone cursor;
+	bool cursor_dirty = true;
+	float last_size = 0;
+
+	TripleBuffer<View> views;			  // render thread -> simulation thread
+	TripleBuffer<SceneSnapshot> frames;	  // simulation thread -> render thread
+	View sent;							  // the last view posted, on the render thread
+	std::function<void()> published;	  // called on the simulation thread after each snapshot
+
+	std::mutex mutex;  // guards the members below
+	std::condition_variable wake, idle;
+	std::vector<std::function<void()>> changes;	 // posted, not applied yet
+	vec2 mouse_target;
+	unsigned long long posted = 0, done = 0;	 // steps asked for, and the last one published
+	bool stop = false;
+	std::thread thread;	 // last, so that it starts on a complete object
 
    public:
-	Scene(GPUProgram* GPUProgram, Camera* camera) : gpuProgram(GPUProgram), camera(camera) {
+	Simulation(const Camera& camera, std::function<void()> published)
+		: camera(camera), cursor(M, vec2(0, 0), this->camera), published(std::move(published)) {
+		sent.camera = camera;
 		task();
+		thread = std::thread(&Simulation::run, this);
+	}
+
+	// the camera and mode the next snapshots are for; posts a step only when they changed
+	void view(const Camera& camera, MODE mode) {
+		if (camera == sent.camera && mode == sent.mode) return;
+		sent.camera = camera;
+		sent.mode = mode;
+		views.write() = sent;
+		views.publish();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			posted++;
+		}
+		wake.notify_one();
 	}
+
+	// the newest snapshot; stays valid until the next call, on the render thread only
+	const SceneSnapshot& latest() {
+		frames.update();
+		return frames.read();
+	}
+
+	// waits until the latest snapshot shows every change and view posted so far
+	void settle() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return done == posted; });
+	}
+
+	// joins the thread; changes still waiting are dropped
+	void shutdown() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		wake.notify_all();
+		if (thread.joinable()) thread.join();
+	}
+
 	void task() {
-		add_spline(vec2(0.5 * M, 0.0f));
-		add_spline(vec2(1 * M, 0.0f));
-		add_spline(vec2(1.5 * M, 0.0f));
-		add_spline(vec2(2 * M, 0.0f));
-		add_spline(vec2(2.5 * M, 0.0f));
-		add_spline(vec2(3 * M, 0.0f));
-		add_spline(vec2(3.5 * M, 0.0f));
-		add_spline(vec2(4 * M, 0.0f));
+		post([this] {
+			cones.add(M, vec2(0.5 * M, 0.0f));
+			cones.add(M, vec2(1 * M, 0.0f));
+			cones.add(M, vec2(1.5 * M, 0.0f));
+			cones.add(M, vec2(2 * M, 0.0f));
+			cones.add(M, vec2(2.5 * M, 0.0f));
+			cones.add(M, vec2(3 * M, 0.0f));
+			cones.add(M, vec2(3.5 * M, 0.0f));
+			cones.add(M, vec2(4 * M, 0.0f));
+		});
 	}
 	void add_spline(vec2 p) {
-		cones.push_back(Cone(M, p, *camera));
+		post([this, p] { cones.add(M, p); });
 	}
-	void draw_cones() {
-		for (auto& i : cones) {
-			i.draw(gpuProgram, *camera);
+	// shown: the cursor cone is drawn, so the new position needs a step of its own; otherwise it waits
+	// for the next one
+	void set_mouse_pos(vec2 p, bool shown) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			mouse_target = p;
+			if (shown) posted++;
 		}
+		if (shown) wake.notify_one();
+	}
+	void clear() {
+		post([this] { cones.clear(); });
 	}
-	void draw_cone() {
-		Cone c = Cone(M, mouse_pos, *camera, is_cone_size_dynamic);
-		c.draw(gpuProgram, *camera);
+
+	void switch_dynamic() {
+		post([this] {
+			is_cone_size_dynamic = !is_cone_size_dynamic;
+			cursor_dirty = true;
+		});
+	}
+
+	void switch_integrator() {
+		post([this] {
+			integrator = (INTEGRATOR)((integrator + 1) % (SHADER + 1));
+			cursor_dirty = true;
+		});
 	}
-	void draw(MODE mode) {
 
-		grid.update(*camera);
-		singularity.update(*camera);
-		hor.update(*camera, M);
-		for (auto& cone : cones) {
-			cone.update(is_cone_size_dynamic);
+	// The time axis switches between Schwarzschild t and ingoing Eddington-Finkelstein time. Only the
+	// cones bend: r = 2M, the r grid lines and the screen mapping of the camera are the same in both.
+	void switch_coordinates() {
+		post([this] {
+			coords = (coords == SCHWARZSCHILD) ? EDDINGTON_FINKELSTEIN : SCHWARZSCHILD;
+			cones.convert(coords, spacetime());
+			cursor_dirty = true;
+		});
+	}
+
+	void switch_metric() {
+		respace([this] { metric = (METRIC)((metric + 1) % (MINKOWSKI_METRIC + 1)); });
+	}
+
+	void scale_metric_parameter(float s) {
+		respace([this, s] {
+			if (metric == REISSNER_NORDSTROM_METRIC) charge = fmin(charge * s, 0.99f);
+			if (metric == DE_SITTER_METRIC) lambda *= s;
+		});
+	}
+
+	void scale_tolerance(float s) {
+		post([this, s] {
+			tolerance *= s;
+			cursor_dirty = true;
+		});
+	}
+
+	void scale_mass(float s) {
+		respace([this, s] {
+			M *= s;
+			cones.set_mass(M);
+		});
+	}
+
+	~Simulation() {
+		shutdown();
+	}
+
+   private:
+	void post(std::function<void()> change) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			changes.push_back(std::move(change));
+			posted++;
+		}
+		wake.notify_one();
+	}
+
+	void run() {
+		std::vector<std::function<void()>> applying;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [this] { return stop || done != posted; });
+			if (stop) return;
+			unsigned long long step = posted;
+			applying.swap(changes);
+			vec2 mouse = mouse_target;
+			lock.unlock();
+			{
+				Profiler::Scope scope("Simulation::step");
+				if (views.update()) {
+					camera = views.read().camera;
+					mode = views.read().mode;
+				}
+				for (auto& change : applying) change();
+				applying.clear();
+				if (mouse != mouse_pos) cursor_dirty = true;
+				mouse_pos = mouse;
+				update();
+				snapshot(frames.write());
+				frames.publish();
+			}
+			published();
+			lock.lock();
+			done = step;
+			idle.notify_all();
 		}
+	}
 
-		grid.draw(gpuProgram, *camera);
-		singularity.draw(gpuProgram, *camera);
-		hor.draw(gpuProgram, *camera);
-		draw_cones();
-		if (mode == FOLLOW) {
-			draw_cone();
+	void update() {
+		if (camera.get_size() != last_size) {
+			last_size = camera.get_size();
+			if (is_cone_size_dynamic || cursor.lod_changed()) cursor_dirty = true;
+		}
+
+		// the singularity and the culled cones reach half a view beyond every edge, as the horizon dashes
+		// do, since the view may move on while the snapshot is on its way
+		Camera wide = camera;
+		wide.zoom(camera.convert(winWidth / 2, winHeight / 2), 2.0f);
+		{
+			Profiler::Scope scope("Singularity::update");
+			singularity.update(wide);
+		}
+		{
+			Profiler::Scope scope("Horizon::update");
+			hor.update(camera, M, spacetime());
+		}
+		{
+			Profiler::Scope scope("ConeField::update");
+			vec2 a = wide.convert(0, 0), b = wide.convert(winWidth, winHeight);
+			cones.update(is_cone_size_dynamic ? camera.get_size() * 0.1f : 1.0f, is_cone_size_dynamic, integrator,
+						 tolerance, coords, spacetime(), camera.pixels_per_unit(), min(a, b), max(a, b));
+		}
+		if (mode == FOLLOW && cursor_dirty) {
+			Profiler::Scope scope("Cone::update");
+			cursor.move(M, mouse_pos);
+			cursor.update(is_cone_size_dynamic, integrator, tolerance, coords, spacetime());
+			cursor_dirty = false;
 		}
 	}
-	void set_mouse_pos(vec2 p) {
-		mouse_pos = p;
+
+	void snapshot(SceneSnapshot& s) {
+		singularity.snapshot(s.singularity);
+		hor.snapshot(s.horizon);
+		cursor.snapshot(s.cursor_strips, s.cursor_first, s.cursor_triangles);
+		s.follow = (mode == FOLLOW);
+		cones.snapshot(s.cones);
 	}
-	void clear() {
-		cones.clear();
+
+	// the metric and its parameter, kept where it has horizons
+	Spacetime spacetime() {
+		Spacetime s;
+		s.metric = metric;
+		if (metric == REISSNER_NORDSTROM_METRIC) s.q = charge * M;
+		if (metric == DE_SITTER_METRIC) s.q = fmin(lambda, 0.99f / (9 * M * M));
+		return s;
 	}
 
-	void switch_dynamic() {
-		is_cone_size_dynamic = !is_cone_size_dynamic;
+	// Eddington-Finkelstein time depends on the spacetime, so the apexes are moved back to Schwarzschild
+	// time around a change of it
+	template <class F>
+	void respace(F change) {
+		post([this, change] {
+			if (coords == EDDINGTON_FINKELSTEIN) cones.convert(SCHWARZSCHILD, spacetime());
+			change();
+			if (coords == EDDINGTON_FINKELSTEIN) cones.convert(EDDINGTON_FINKELSTEIN, spacetime());
+			cursor_dirty = true;
+		});
+	}
+};
+
+// Draws the latest snapshot of a Simulation on the GL thread. The vertex arrays mirror the snapshot, so
+// only the parts that changed since the last frame are copied and uploaded.
+class Scene {
+	GPUProgram* gpuProgram;
+	GPUProgram* coneProgram;
+	GPUProgram* gridProgram;
+	Camera* camera;
+	Grid grid;
+	ConeBatch cones;
+	VertexArray<vec2> singularity, horizon;
+	VertexArray<vec2> cursor_strips, cursor_triangles;
+	LineBatch background, overlay;	// below and above the cones
+
+   public:
+	Scene(GPUProgram* gpuProgram, GPUProgram* coneProgram, GPUProgram* gridProgram, Camera* camera)
+		: gpuProgram(gpuProgram), coneProgram(coneProgram), gridProgram(gridProgram), camera(camera) {}
+
+	void draw(const SceneSnapshot& s) {
+		{
+			Profiler::Scope scope("background");
+			Profiler::GpuScope gpu("background");
+			grid.draw(gridProgram, *camera);
+			singularity.mirror(s.singularity);
+			horizon.mirror(s.horizon);
+			background.add(singularity, GL_LINES, vec4(0.25f, 0.5f, 1.0f, 1.0f), 10);
+			background.add(horizon, GL_LINES, vec4(0.25f, 1.0f, 0.5f, 1.0f), 2);
+			background.draw(gpuProgram, *camera);
+		}
+		{
+			Profiler::Scope scope("ConeBatch::draw");
+			Profiler::GpuScope gpu("cones");
+			cones.draw(gpuProgram, coneProgram, *camera, s.cones);
+		}
+		if (s.follow) {
+			Profiler::Scope scope("overlay");
+			Profiler::GpuScope gpu("overlay");
+			vec4 color(1.0f, 1.0f, 0.0f, 1.0f);
+			cursor_strips.mirror(s.cursor_strips);
+			cursor_triangles.mirror(s.cursor_triangles);
+			for (size_t i = 0; i + 1 < s.cursor_first.size(); i++) {
+				overlay.add(cursor_strips, GL_LINE_STRIP, color, 3, s.cursor_first[i],
+							s.cursor_first[i + 1] - s.cursor_first[i]);
+			}
+			overlay.add(cursor_triangles, GL_TRIANGLES, color, 3);
+			overlay.draw(gpuProgram, *camera);
+		}
 	}
 };
 
 class MyApp : public glApp {
 	const float FPS = 60.0f;
 	GPUProgram* gpuProgram;
+	GPUProgram* coneProgram;
+	GPUProgram* gridProgram;
+	Simulation* simulation;
 	Scene* scene;
 	float lastTime = 0.0f;
 	bool pressed = false;
+	bool recording = false;	 // every frame goes to capture0000.png, capture0001.png, ...
 	vec2 pressedPos;
 	enum MODE mode = PUT;
 	vec2 size = vec2(10, 10);
 	Camera camera = Camera(vec2(size.x / 2.0f, 0), size);
 
    public:
-	MyApp() : glApp("") {}
+	MyApp() : glApp("") {
+		setFrameRate(FPS);
+	}
 
 	void onInitialization() override {
 		gpuProgram = new GPUProgram(vert_source, fragSource);
-		scene = new Scene(gpuProgram, &camera);
+		coneProgram = new GPUProgram(cone_vert_source, fragSource);
+		gpuProgram->bindBlock("CameraBlock", Camera::block_binding);
+		coneProgram->bindBlock("CameraBlock", Camera::block_binding);
+		gridProgram = new GPUProgram(grid_vert_source, grid_frag_source);
+		gridProgram->bindBlock("CameraBlock", Camera::block_binding);
+		simulation = new Simulation(camera, [this] { refreshScreen(); });
+		scene = new Scene(gpuProgram, coneProgram, gridProgram, &camera);
 	}
 
 	void onDisplay() override {
+		Profiler::Scope scope("onDisplay");
+		Profiler::GpuScope gpu("frame");
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT);
 
-		// multipliers to make it work properly on 2560*1440 screens
-		glViewport(0, 0, winWidth * 2, winHeight * 2);
-		scene->draw(mode);
+		int width, height;	// more pixels than winWidth * winHeight on HiDPI screens
+		getFramebufferSize(&width, &height);
+		glViewport(0, 0, width, height);
+		simulation->view(camera, mode);
+		if (offscreen()) simulation->settle();	// every frame of a file shows the state it was drawn in
+		scene->draw(simulation->latest());
 	}
 	void onTimeElapsed(float startTime, float endTime) {
 		// refreshScreen();
@@ -475,7 +2210,7 @@ class MyApp : public glApp {
 
 		if (but == MOUSE_LEFT) {
 			if (p.x >= 0) {
-				scene->add_spline(p);
+				simulation->add_spline(p);
 			}
 		} else {
 			pressed = true;
@@ -489,13 +2224,11 @@ class MyApp : public glApp {
 	}
 
 	void onMouseMotion(int pX, int pY) {
-		scene->set_mouse_pos(camera.convert(pX, pY));
+		simulation->set_mouse_pos(camera.convert(pX, pY), mode == FOLLOW);  // its step refreshes the screen
 		if (pressed) {
 			vec2 p = camera.convert(pX, pY);
 			vec2 v = pressedPos - p;
 			camera.addOrigo(v);
-		}
-		if (pressed || mode == FOLLOW) {
 			refreshScreen();
 		}
 	}
@@ -503,7 +2236,8 @@ class MyApp : public glApp {
 	void onMouseScroll(float amount, int pX, int pY) {
 		vec2 p = camera.convert(pX, pY);
 
-		camera.zoom(p, 1.0f - amount * 0.1f);
+		// 10% per wheel step; amount sums the steps of a frame, so the steps are multiplied
+		camera.zoom(p, amount > 0 ? powf(0.9f, amount) : powf(1.1f, -amount));
 		refreshScreen();
 	}
 
@@ -513,19 +2247,65 @@ class MyApp : public glApp {
 				mode = (mode == PUT) ? FOLLOW : PUT;
 				break;
 			case 't':
-				scene->task();
+				simulation->task();
 				break;
 			case 'c':
-				scene->clear();
+				simulation->clear();
 				break;
 			case 'r':
-				scene->switch_dynamic();
+				simulation->switch_dynamic();
+				break;
+			case 'i':
+				simulation->switch_integrator();
+				break;
+			case 'e':
+				simulation->switch_coordinates();
+				break;
+			case 'g':
+				simulation->switch_metric();
+				break;
+			case ']':
+				simulation->scale_metric_parameter(1.25f);
+				break;
+			case '[':
+				simulation->scale_metric_parameter(0.8f);
+				break;
+			case '+':
+				simulation->scale_tolerance(0.5f);
+				break;
+			case '-':
+				simulation->scale_tolerance(2.0f);
+				break;
+			case '>':
+				simulation->scale_mass(1.25f);
+				break;
+			case '<':
+				simulation->scale_mass(0.8f);
+				break;
+			case 'f':	// profile into trace.json, the summary when it stops
+				if (!profiler().tracing()) {
+					if (!profiler().startTrace("trace.json")) printf("trace.json cannot be written\n");
+				} else {
+					profiler().stopTrace();
+					profiler().enabled = false;
+					printf("%s", profiler().summary().c_str());
+				}
+				break;
+			case 'p':
+				recording = !recording;
+				if (recording) startCapture("capture");
+				else stopCapture();
+				break;
 			default:
 				break;
 		}
 		refreshScreen();
 	}
 
+	void onClose() override {
+		simulation->shutdown();	 // before the thread pool it uses goes away
+	}
+
 	~MyApp() {}
 };
 
@@ -4,14 +4,48 @@
 #include "framework.h"
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
+#include <atomic>
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 // Keretrendszer �llapota
 static int minorNumber = 3, majorNumber = 3;
 static int windowWidth = 600, windowHeight = 600;
 static const char* windowCaption = "Grafika";
 static GLFWwindow* window;
-static bool screenRefresh = true;
+// in pixels, more than the window on HiDPI; read by the simulation thread too, see Camera::pixels_per_unit
+static std::atomic<int> framebufferWidth(600), framebufferHeight(600);
+static std::atomic<bool> screenRefresh(true);	// requests coalesce into the next frame
+static std::atomic<bool> eventsReady(false);	// glfwInit done, glfwPostEmptyEvent may be called
+static double frameTime = 0;					// the shortest time between frames, 0: vsync only
 static glApp* pApp = nullptr;
+static FrameCapture* recorder = nullptr;  // while startCapture is in effect
+static std::string capturePrefix;
+static int capturedFrames = 0;
+static bool rendersOffscreen = false;  // runHeadless
+
+// Motion and scroll events arrive at the rate of the mouse, several per frame. They are coalesced and
+// dispatched once per frame, right before it is drawn, or at once while no frame is pending so that they
+// can ask for one; and before any button or key event so that those see the cursor where it is.
+static struct {
+	bool motion = false, scroll = false;
+	double x = 0, y = 0;			   // last cursor position
+	double amount = 0, sX = 0, sY = 0;  // summed scroll, and where the last scroll happened
+} input;
+
+static void flushInput() {
+	if (input.scroll) {	 // before the motion, which then sees the zoomed camera
+		input.scroll = false;
+		pApp->onMouseScroll((float)input.amount, (int)input.sX, (int)input.sY);
+		input.amount = 0;
+	}
+	if (input.motion) {
+		input.motion = false;
+		pApp->onMouseMotion((int)input.x, (int)input.y);
+	}
+}
 
 // Esem�nykezel�k
 static void error_callback(int error, const char* description) {
@@ -22,23 +56,32 @@ static void window_refresh_callback(GLFWwindow* window) {
 	screenRefresh = true;
 }
 
+static void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
+	framebufferWidth = width;
+	framebufferHeight = height;
+	screenRefresh = true;
+}
+
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
 		glfwSetWindowShouldClose(window, GLFW_TRUE);
 		return;
 	}
 	if ((mods & GLFW_MOD_SHIFT) == 0) key += 'a' - 'A';
+	flushInput();
 	if (action == GLFW_PRESS || action == GLFW_REPEAT) pApp->onKeyboard(key);
 	if (action == GLFW_RELEASE) pApp->onKeyboardUp(key);
 }
 
 void character_callback(GLFWwindow* window, unsigned int codepoint) {
+	flushInput();
 	pApp->onKeyboard(codepoint);
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
 	double pX, pY;
 	glfwGetCursorPos(window, &pX, &pY);
+	flushInput();
 	if (action == GLFW_PRESS)
 		pApp->onMousePressed((button == GLFW_MOUSE_BUTTON_LEFT) ? MOUSE_LEFT : MOUSE_RIGHT, (int)pX, (int)pY);
 	else
@@ -49,11 +92,16 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
 	double pX, pY;
 	glfwGetCursorPos(window, &pX, &pY);
-	pApp->onMouseScroll(yoffset, pX, pY);
+	input.scroll = true;
+	input.amount += yoffset;
+	input.sX = pX;
+	input.sY = pY;
 }
 
 static void cursor_position_callback(GLFWwindow* window, double xpos, double ypos) {
-	pApp->onMouseMotion((int)xpos, (int)ypos);
+	input.motion = true;
+	input.x = xpos;
+	input.y = ypos;
 }
 
 // Applik�ci� konstruktora
@@ -78,19 +126,147 @@ glApp::glApp(const char* _windowCaption) {
 }
 
 // Rajzold �jra az alkalmaz�si ablakot
-void glApp::refreshScreen() {
-	screenRefresh = true;
+void glApp::refreshScreen() {	 // any thread
+	if (!screenRefresh.exchange(true) && eventsReady) glfwPostEmptyEvent();	 // wakes the main loop
+}
+
+void glApp::startCapture(const char* prefix) {
+	stopCapture();
+	recorder = new FrameCapture();
+	capturePrefix = prefix;
+	capturedFrames = 0;
+	refreshScreen();
+}
+
+void glApp::stopCapture() {
+	delete recorder;  // writes the queued frames
+	recorder = nullptr;
+}
+
+// after onDisplay, before the buffers are swapped
+static void captureFrame() {
+	if (!recorder) return;
+	char number[16];
+	snprintf(number, sizeof(number), "%04d.png", capturedFrames++);
+	recorder->capture(capturePrefix + number, framebufferWidth, framebufferHeight);
+}
+
+void glApp::setFrameRate(float fps) {
+	frameTime = fps > 0 ? 1.0 / fps : 0;
 }
 
 // Lek�rdez�ses klaviat�ra kezel�s
 bool pollKey(int key) {
-	return (glfwGetKey(window, key) == GLFW_PRESS);
+	return window != nullptr && (glfwGetKey(window, key) == GLFW_PRESS);
+}
+
+void getFramebufferSize(int* width, int* height) {
+	*width = framebufferWidth;
+	*height = framebufferHeight;
 }
 
-int main(void) {
+bool offscreen() {
+	return rendersOffscreen;
+}
+
+#ifdef HEADLESS
+// Renders frames into an FBO of an EGL context without a surface, and writes each to
+// <prefix>NNNN.png. Needs no display server: Mesa gives such a context on its software rasteriser,
+// llvmpipe, when there is no GPU. Between frames the application gets onTimeElapsed at the frame
+// rate, as if the frames were shown.
+static int runHeadless(int frames, const char* prefix, int scale) {
+	EGLDisplay display = EGL_NO_DISPLAY;
+	auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay) display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "Error: no EGL display\n");
+		return EXIT_FAILURE;
+	}
+	EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	EGLint configs = 0;
+	eglChooseConfig(display, configAttributes, &config, 1, &configs);
+	if (configs == 0) config = EGL_NO_CONFIG_KHR;  // EGL_KHR_no_config_context
+	EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION, majorNumber, EGL_CONTEXT_MINOR_VERSION, minorNumber,
+								  EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		fprintf(stderr, "Error: no surfaceless OpenGL %d.%d context\n", majorNumber, minorNumber);
+		eglTerminate(display);
+		return EXIT_FAILURE;
+	}
+	gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+
+	framebufferWidth = windowWidth * scale;
+	framebufferHeight = windowHeight * scale;
+	GLuint fbo, color;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenRenderbuffers(1, &color);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, framebufferWidth, framebufferHeight);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+
+	rendersOffscreen = true;
+	pApp->onInitialization();
+	double dt = frameTime > 0 ? frameTime : 1.0 / 60;
+	int result = EXIT_SUCCESS;
+	{
+		FrameCapture frameCapture;	// encodes while the next frames render
+		for (int frame = 0; frame < frames; frame++) {
+			pApp->onTimeElapsed((float)(frame * dt), (float)((frame + 1) * dt));
+			pApp->onDisplay();
+			char number[16];
+			snprintf(number, sizeof(number), "%04d.png", frame);
+			frameCapture.capture(prefix + std::string(number), framebufferWidth, framebufferHeight);
+			streamBuffer().endFrame();
+			profiler().endFrame();
+		}
+		if (!frameCapture.finish()) result = EXIT_FAILURE;
+	}
+	pApp->onClose();
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglTerminate(display);
+	return result;
+}
+#endif
+
+int main(int argc, char* argv[]) {
+	// --headless [--frames N] [--out prefix] [--scale S]: render into files instead of a window
+	// --trace file: profile into a Chrome trace, with a summary at exit
+	bool headless = false;
+	int frames = 1, scale = 1;
+	const char* prefix = "frame";
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool value = i + 1 < argc;
+		if (arg == "--headless") headless = true;
+		else if (arg == "--frames" && value) frames = atoi(argv[++i]);
+		else if (arg == "--out" && value) prefix = argv[++i];
+		else if (arg == "--scale" && value) scale = std::max(1, atoi(argv[++i]));
+		else if (arg == "--trace" && value && !profiler().startTrace(argv[++i])) {
+			fprintf(stderr, "Error: %s cannot be written\n", argv[i]);
+		}
+	}
+	if (headless) {
+#ifdef HEADLESS
+		int result = runHeadless(frames, prefix, scale);
+		if (profiler().tracing()) {
+			profiler().stopTrace();
+			printf("%s", profiler().summary().c_str());
+		}
+		return result;
+#else
+		fprintf(stderr, "Error: built without EGL, --headless is not available\n");
+		return EXIT_FAILURE;
+#endif
+	}
+
 	// Alkalmaz�i ablak l�trehoz�sa
 	glfwSetErrorCallback(error_callback);
 	if (!glfwInit()) exit(EXIT_FAILURE);
+	eventsReady = true;
 
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, majorNumber);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minorNumber);
@@ -109,6 +285,11 @@ int main(void) {
 	glfwSetScrollCallback(window, scroll_callback);
 	glfwSetCursorPosCallback(window, cursor_position_callback);
 	glfwSetWindowRefreshCallback(window, window_refresh_callback);
+	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	int width, height;
+	glfwGetFramebufferSize(window, &width, &height);
+	framebufferWidth = width;
+	framebufferHeight = height;
 
 	glfwMakeContextCurrent(window);
 	gladLoadGL();
@@ -117,21 +298,43 @@ int main(void) {
 	// Applik�ci� inicializ�l�sa
 	pApp->onInitialization();
 	float startTime = 0;
+	double nextFrame = 0;
 
-	// �zenetkezel� hurok
+	// �zenetkezel� hurok: sleeps until an event or a redraw request, and draws requested frames
+	// no more often than the frame rate allows
 	while (!glfwWindowShouldClose(window)) {
-		glfwPollEvents();  // esem�nyek lek�rdez�se �s reakci�
+		double now = glfwGetTime();
+		if (!screenRefresh) {
+			glfwWaitEvents();
+		} else if (now < nextFrame) {
+			glfwWaitEventsTimeout(nextFrame - now);	 // events still go through while the frame is due
+		} else {
+			glfwPollEvents();
+		}
+		if (!screenRefresh) flushInput();
 
 		float endTime = (float)glfwGetTime();	  // id� lek�rdez�se
 		pApp->onTimeElapsed(startTime, endTime);  // anim�ci�
 		startTime = endTime;
 
-		if (screenRefresh) {
+		now = glfwGetTime();
+		if (screenRefresh && now >= nextFrame) {
+			flushInput();
+			screenRefresh = false;	  // requests made while drawing ask for another frame
 			pApp->onDisplay();		  // rajzol�s
+			captureFrame();
+			streamBuffer().endFrame();
+			profiler().endFrame();
 			glfwSwapBuffers(window);  // buffercsere
-			screenRefresh = false;
+			nextFrame = std::max(nextFrame, now) + frameTime;	 // an idle spell earns no catch-up frames
 		}
 	}
+	pApp->stopCapture();
+	pApp->onClose();
+	if (profiler().tracing()) {
+		profiler().stopTrace();
+		printf("%s", profiler().summary().c_str());
+	}
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
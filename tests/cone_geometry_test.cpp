@@ -0,0 +1,31 @@
+// Cone branches marched into the singularity: every integrator has to follow the ingoing future
+// branch down to r = 0 instead of stopping a step short of it, and draw nothing for an apex beyond it.
+#include "stubs.h"
+
+// r where the future ingoing branch of the cone at r0 ends, inside the horizon of M = 1
+static float ingoing_end(INTEGRATOR integrator, float r0) {
+	ConeGeometry geom;
+	geom.generate(1, vec2(r0, 0), 0.5f, integrator);
+	const std::vector<vec2>& branch = geom.vtx[2];	// see ConeGeometry::generate
+	return branch.empty() ? r0 : branch.back().x;
+}
+
+int main() {
+	int failed = 0;
+	for (INTEGRATOR integrator : {EULER, DOPRI, TORTOISE}) {
+		for (float r0 : {0.05f, 0.2f}) {
+			float end = ingoing_end(integrator, r0);
+			bool ok = end >= 0 && end < 0.01f;
+			printf("%s integrator %d, apex at r = %g: ingoing branch ends at r = %g\n", ok ? "ok  " : "FAIL",
+				   integrator, r0, end);
+			if (!ok) failed++;
+		}
+		ConeGeometry geom;
+		geom.generate(1, vec2(-0.1f, 0), 0.5f, integrator);
+		size_t n = geom.triangle_vtx.size();
+		for (const std::vector<vec2>& branch : geom.vtx) n += branch.size();
+		printf("%s integrator %d, apex at r = -0.1: %zu vertices\n", n == 0 ? "ok  " : "FAIL", integrator, n);
+		if (n != 0) failed++;
+	}
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,96 @@
+// How a snapshot gets from the simulation thread to the renderer: TripleBuffer hands over the latest one
+// and only that, once, and Part::take and VertexArray::mirror copy vertices only when their revision moved.
+#include "stubs.h"
+
+static int failed = 0;
+
+static void check(bool ok, const char* what) {
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failed++;
+}
+
+// filled with one value throughout, so that a torn copy shows
+struct Value {
+	int v[256];
+	void set(int x) {
+		for (int& e : v) e = x;
+	}
+	bool whole() const {
+		for (int e : v) {
+			if (e != v[0]) return false;
+		}
+		return true;
+	}
+};
+
+static void triple_buffer() {
+	TripleBuffer<int> b;
+	check(!b.update(), "TripleBuffer: nothing to take before the first publish");
+	b.write() = 1;
+	b.publish();
+	check(b.update() && b.read() == 1, "TripleBuffer: a published value is taken");
+	check(!b.update() && b.read() == 1, "TripleBuffer: it is taken once, and read() keeps it");
+	b.write() = 2;
+	b.publish();
+	b.write() = 3;
+	b.publish();
+	check(b.update() && b.read() == 3, "TripleBuffer: of two publishes the later one is taken");
+	check(&b.write() != &b.read(), "TripleBuffer: the writer never gets the slot being read");
+
+	TripleBuffer<Value> t;
+	const int n = 100000;
+	std::atomic<bool> done{false};
+	std::thread writer([&t, &done] {
+		for (int i = 1; i <= n; i++) {
+			t.write().set(i);
+			t.publish();
+		}
+		done = true;
+	});
+	int last = 0;
+	bool ordered = true, whole = true;
+	while (true) {
+		bool finished = done;
+		if (!t.update()) {
+			if (finished) break;
+			continue;
+		}
+		const Value& v = t.read();
+		ordered = ordered && v.v[0] > last;
+		whole = whole && v.whole();
+		last = v.v[0];
+	}
+	writer.join();
+	check(ordered, "TripleBuffer: a reader on another thread sees only newer values");
+	check(whole, "TripleBuffer: and never one the writer is still filling");
+	check(last == n, "TripleBuffer: the last value published reaches it");
+}
+
+static void parts() {
+	VertexArray<vec2> source;
+	source.edit() = {vec2(1, 2), vec2(3, 4)};
+	Part<vec2> part;
+	check(part.take(source) && part.data == source.get(), "Part: take() copies a new revision");
+	part.data[0] = vec2(0, 0);	// marks the copy: taking the same revision again must leave it
+	check(!part.take(source) && part.data[0] == vec2(0, 0), "Part: the same revision is not copied again");
+	source.edit()[1] = vec2(5, 6);
+	check(part.take(source) && part.data == source.get(), "Part: edit() makes the next take() copy");
+
+	VertexArray<vec2> mirror;
+	mirror.mirror(part);
+	unsigned long long revision = mirror.get_revision();
+	check(mirror.get() == part.data, "VertexArray: mirror() copies the part");
+	mirror.mirror(part);
+	check(mirror.get_revision() == revision, "VertexArray: a part it already has does not bump the revision");
+	source.edit().push_back(vec2(7, 8));
+	part.take(source);
+	mirror.mirror(part);
+	check(mirror.get_revision() != revision && mirror.get() == part.data,
+		  "VertexArray: a newer part is copied and bumps the revision");
+}
+
+int main() {
+	triple_buffer();
+	parts();
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
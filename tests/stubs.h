@@ -0,0 +1,16 @@
+// MyApp.cpp without framework.cpp: the tests exercise CPU code only, so the window and the render loop
+// are left out and what MyApp.cpp calls of them does nothing.
+#include "../src/MyApp.cpp"
+
+glApp::glApp(const char*) {}
+void glApp::refreshScreen() {}
+void glApp::setFrameRate(float) {}
+void glApp::startCapture(const char*) {}
+void glApp::stopCapture() {}
+void getFramebufferSize(int* width, int* height) {
+	*width = winWidth;
+	*height = winHeight;
+}
+bool offscreen() {
+	return true;
+}
@@ -0,0 +1,95 @@
+// The SSE2 closed form against the scalar one it replaces: exp_ps and log_ps against expf and logf, and
+// tortoise_kernel and chord_bisect4 against the same formulas evaluated a vertex at a time, from just off
+// the horizon to far out. Errors are counted in float roundings at the magnitude of the result.
+#include <cfloat>
+#include "stubs.h"
+
+static const float M = 1;
+static int failed = 0;
+
+static void check(bool ok, const std::string& what, double ulps) {
+	printf("%s %s: %.2f roundings off\n", ok ? "ok  " : "FAIL", what.c_str(), ulps);
+	if (!ok) failed++;
+}
+
+static double ulps(double value, double reference, double magnitude) {
+	return fabs(value - reference) / (FLT_EPSILON * magnitude);
+}
+
+// the fallback of tortoise_kernel, as it runs without SSE2
+static vec2 scalar_vertex(int i, float r0, float w0, float dw, float side, float kappa, float c) {
+	float r = 2 * M + side * exp(w0 + i * dw);
+	return vec2(r, kappa * (r - r0) + c * 2 * M * (i * dw));
+}
+
+// the fallback of chord_bisect4 for one branch
+static float scalar_bisect(float r0, float len, float c, float hi) {
+	float w0 = log(fabs(r0 - 2 * M));
+	float a = r0, b = hi;
+	for (int i = 0; i < 24; i++) {
+		float m = (a + b) / 2;
+		float dt = m - r0 + c * 2 * M * (log(fabs(m - 2 * M)) - w0);
+		if ((m - r0) * (m - r0) + dt * dt < len * len) a = m;
+		else b = m;
+	}
+	return a;
+}
+
+int main() {
+#ifdef __SSE2__
+	double worst = 0;
+	for (float x = -80; x < 80; x += 0.0137f) {
+		float e[4];
+		_mm_storeu_ps(e, exp_ps(_mm_set1_ps(x)));
+		worst = fmax(worst, ulps(e[0], expf(x), expf(x)));
+	}
+	check(worst <= 2, "exp_ps", worst);
+	worst = 0;
+	for (float x = 1e-30f; x < 1e30f; x *= 1.0173f) {
+		float l[4];
+		_mm_storeu_ps(l, log_ps(_mm_set1_ps(x)));
+		worst = fmax(worst, ulps(l[0], logf(x), fmax(fabs(logf(x)), 1.0f)));
+	}
+	check(worst <= 2, "log_ps", worst);
+#endif
+
+	for (float r0 : {2.000001f, 2.0001f, 1.9999f, 2.01f, 1.5f, 0.3f, 50.0f, 1000.0f, 10000.0f}) {
+		char apex[32];
+		snprintf(apex, sizeof(apex), ", apex at r = %.7g", r0);
+		float side = (r0 > 2 * M) ? 1.0f : -1.0f;
+		float w0 = log(fabs(r0 - 2 * M));
+		double worst = 0;
+		for (float dw : {-0.3f, -0.02f, 0.02f, 0.3f}) {
+			for (float kappa : {1.0f, -1.0f}) {
+				for (float c : {1.0f, -1.0f, 2.0f, 0.0f}) {
+					vec2 out[37];  // not a multiple of 4, so the scalar tail runs too
+					tortoise_kernel(out, 37, r0, 0, M, w0, dw, side, kappa, c);
+					for (int i = 0; i < 37; i++) {
+						vec2 v = scalar_vertex(i, r0, w0, dw, side, kappa, c);
+						float magnitude = fmax(fmax(fabs(v.x), fabs(v.y)), 2 * M);
+						worst = fmax(worst, ulps(out[i].x, v.x, magnitude));
+						worst = fmax(worst, ulps(out[i].y, v.y, magnitude));
+					}
+				}
+			}
+		}
+		check(worst <= 4, "tortoise_kernel" + std::string(apex), worst);
+
+		worst = 0;
+		for (float len : {0.01f, 0.5f, 20.0f}) {
+			for (float c : {1.0f, 2.0f}) {
+				float hi[4] = {r0 + len, r0 - len, r0 + 0.5f * len, r0 - 0.5f * len}, r[4];
+				for (float& h : hi) {  // on the side of the horizon r0 is on, and not below r = 0
+					h = (side > 0) ? fmax(h, 2 * M + 1e-6f) : fmax(fmin(h, 2 * M - 1e-6f), 0.0f);
+				}
+				chord_bisect4(r0, M, len, c, hi, r);
+				for (int k = 0; k < 4; k++) {
+					float s = scalar_bisect(r0, len, c, hi[k]);
+					worst = fmax(worst, ulps(r[k], s, fmax(fabs(s), 2 * M)));
+				}
+			}
+		}
+		check(worst <= 4, "chord_bisect4" + std::string(apex), worst);
+	}
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}